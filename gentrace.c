@@ -0,0 +1,565 @@
+/*
+ * gentrace.c - write synthetic traces for the malloc driver
+ *
+ * The traces in traces/ come from a handful of old programs. gentrace
+ * draws allocations from a mix of patterns instead, each with its own
+ * size and lifetime distribution, and writes them as a .rep file that
+ * mdriver -f can replay. The same seed always gives the same trace.
+ *
+ * usage: gentrace [-h] [-s <seed>] [-n <ops>] [-m <bytes>] [-o <file>]
+ *                 [-p <spec>]
+ *
+ * spec is a comma separated list of pattern:share, for instance
+ * "bimodal:4,queue:2,powerlaw:3,growing:1". Each step picks one pattern
+ * with probability proportional to its share. The patterns are:
+ *
+ *   bimodal   90% small blocks of 8-128 bytes, 10% large blocks of
+ *             4-64 KB, exponential lifetimes of 50 steps on average
+ *   queue     messages of 64-512 bytes, freed in FIFO order once more
+ *             than QUEUE_DEPTH are outstanding
+ *   powerlaw  log-uniform sizes of 16 bytes to 64 KB with Pareto
+ *             lifetimes (alpha 1.2), so a few blocks live almost forever
+ *   growing   up to GROW_BUFS buffers, grown by realloc in steps of
+ *             5-25% until they pass 1 MB and are freed
+ *   batch     batches of 8-64 equal blocks of 16-256 bytes, as one
+ *             'A' request, freed as one 'F' in FIFO order once more
+ *             than BATCH_DEPTH are outstanding
+ *   arena     objects of 16-256 bytes from one of ARENAS arenas, as 'x'
+ *             requests; an arena is reset with one 'X' after 16-512
+ *             objects
+ *
+ * Lifetimes count steps, that is allocations and reallocs. No more than
+ * <bytes> of payload are live at once (default 32 MB, well below
+ * MAX_HEAP); the block due first is freed early to make room. Ids of
+ * freed blocks are reused, so num_ids is the peak number of live blocks.
+ * A batch and the objects of an arena up to its reset take a fresh run
+ * of ids instead, since their requests name ids id..id+n-1.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#define MAXLINE     1024       /* max string size */
+#define QUEUE_DEPTH 256        /* messages outstanding in a queue */
+#define GROW_BUFS   8          /* growing buffers at once */
+#define GROW_MAX    (1 << 20)  /* a buffer is freed past this size */
+#define BATCH_DEPTH 16         /* batches outstanding */
+#define ARENAS      4          /* arenas filled at once */
+
+/* the patterns, in the order of their shares */
+enum { BIMODAL, QUEUE, POWERLAW, GROWING, BATCH, ARENA, NUM_PATTERNS };
+static const char *pattern_names[NUM_PATTERNS] = {
+    "bimodal", "queue", "powerlaw", "growing", "batch", "arena"
+};
+
+/* a run of ids: a batch, or the objects of an arena since its reset */
+typedef struct {
+    int id;     /* first id */
+    int n;      /* ids in use */
+    int cap;    /* ids reserved, for an arena */
+} run_t;
+
+/* a pending free: block id is freed at step due */
+typedef struct {
+    unsigned long due;
+    int id;
+} event_t;
+
+/* Global variables */
+static unsigned long long rng_state;  /* xorshift64* state */
+static FILE *body;                    /* ops, written ahead of the header */
+static unsigned long num_ops = 0;     /* ops written so far */
+static unsigned long step = 0;        /* allocations and reallocs so far */
+static size_t live = 0;               /* live payload bytes */
+static size_t max_live = 32 << 20;    /* bound on live payload bytes */
+
+static size_t *sizes = NULL;          /* payload size of each id */
+static int num_ids = 0;               /* ids ever handed out */
+static int cap_ids = 0;               /* length of sizes */
+static int *free_ids = NULL;          /* ids ready for reuse (a stack) */
+static int num_free_ids = 0;
+
+static event_t *events = NULL;        /* pending frees (a min-heap) */
+static int num_events = 0;
+static int cap_events = 0;
+
+static int queue[QUEUE_DEPTH + 1];    /* outstanding messages (a ring) */
+static int queue_head = 0, queue_len = 0;
+
+static int grow_ids[GROW_BUFS];       /* growing buffers, -1 if none */
+
+static run_t batches[BATCH_DEPTH + 1];/* outstanding batches (a ring) */
+static int batch_head = 0, batch_len = 0;
+
+static run_t arenas[ARENAS];          /* arenas, n == 0 if empty */
+static int max_id = -1;               /* highest id used by a request */
+
+/* Function prototypes */
+static void usage(void);
+static void app_error(const char *msg);
+
+/*
+ * rand_u64 - Next number of the xorshift64* generator
+ */
+static unsigned long long rand_u64(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+/*
+ * rand_unit - Uniform double in (0, 1)
+ */
+static double rand_unit(void)
+{
+    return ((rand_u64() >> 11) + 0.5) / (double)(1ULL << 53);
+}
+
+/*
+ * rand_range - Uniform integer in [lo, hi]
+ */
+static size_t rand_range(size_t lo, size_t hi)
+{
+    return lo + rand_u64() % (hi - lo + 1);
+}
+
+/*
+ * rand_log - Log-uniform integer in [lo, hi]
+ */
+static size_t rand_log(size_t lo, size_t hi)
+{
+    return (size_t)(lo * pow((double)hi / lo, rand_unit()));
+}
+
+/*
+ * new_ids - A run of n fresh ids, never used before
+ */
+static int new_ids(int n)
+{
+    while (num_ids + n > cap_ids) {
+        cap_ids = cap_ids ? 2 * cap_ids : 1024;
+        sizes = realloc(sizes, cap_ids * sizeof(size_t));
+        free_ids = realloc(free_ids, cap_ids * sizeof(int));
+        if (sizes == NULL || free_ids == NULL)
+            app_error("out of memory");
+    }
+    num_ids += n;
+    return num_ids - n;
+}
+
+/*
+ * new_id - An id for a new block: a freed one if possible
+ */
+static int new_id(void)
+{
+    if (num_free_ids > 0)
+        return free_ids[--num_free_ids];
+    return new_ids(1);
+}
+
+/*
+ * push_event - Schedule the free of block id at step due
+ */
+static void push_event(unsigned long due, int id)
+{
+    int i, parent;
+
+    if (num_events == cap_events) {
+        cap_events = cap_events ? 2 * cap_events : 1024;
+        if ((events = realloc(events, cap_events * sizeof(event_t))) == NULL)
+            app_error("out of memory");
+    }
+
+    /* sift up */
+    for (i = num_events++; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (events[parent].due <= due)
+            break;
+        events[i] = events[parent];
+    }
+    events[i].due = due;
+    events[i].id = id;
+}
+
+/*
+ * pop_event - Remove the earliest pending free and return its id
+ */
+static int pop_event(void)
+{
+    int id = events[0].id;
+    event_t last = events[--num_events];
+    int i = 0, child;
+
+    /* sift down */
+    while ((child = 2 * i + 1) < num_events) {
+        if (child + 1 < num_events && events[child + 1].due < events[child].due)
+            child++;
+        if (last.due <= events[child].due)
+            break;
+        events[i] = events[child];
+        i = child;
+    }
+    events[i] = last;
+    return id;
+}
+
+/*
+ * emit_alloc, emit_realloc, emit_free - Write one op and track the
+ *     live bytes and ids
+ */
+static void emit_alloc(int id, size_t size)
+{
+    fprintf(body, "a %d %lu\n", id, size);
+    sizes[id] = size;
+    live += size;
+    max_id = (id > max_id) ? id : max_id;
+    num_ops++;
+    step++;
+}
+
+static void emit_realloc(int id, size_t size)
+{
+    fprintf(body, "r %d %lu\n", id, size);
+    live += size - sizes[id];
+    sizes[id] = size;
+    num_ops++;
+    step++;
+}
+
+static void emit_free(int id)
+{
+    fprintf(body, "f %d\n", id);
+    live -= sizes[id];
+    free_ids[num_free_ids++] = id;
+    num_ops++;
+}
+
+/*
+ * emit_batch, emit_batch_free, emit_arena_alloc, emit_arena_reset - The
+ *     same for runs of ids; the ids of a run are reused as single ids
+ *     once it is freed
+ */
+static void emit_batch(int id, int n, size_t size)
+{
+    int i;
+
+    fprintf(body, "A %d %d %lu\n", id, n, size);
+    for (i = 0; i < n; i++)
+        sizes[id + i] = size;
+    live += n * size;
+    max_id = (id + n - 1 > max_id) ? id + n - 1 : max_id;
+    num_ops++;
+    step++;
+}
+
+static void emit_batch_free(run_t *run)
+{
+    int i;
+
+    fprintf(body, "F %d %d\n", run->id, run->n);
+    for (i = 0; i < run->n; i++) {
+        live -= sizes[run->id + i];
+        free_ids[num_free_ids++] = run->id + i;
+    }
+    num_ops++;
+}
+
+static void emit_arena_alloc(int a, int id, size_t size)
+{
+    fprintf(body, "x %d %d %lu\n", a, id, size);
+    sizes[id] = size;
+    live += size;
+    max_id = (id > max_id) ? id : max_id;
+    num_ops++;
+    step++;
+}
+
+static void emit_arena_reset(int a)
+{
+    run_t *run = &arenas[a];
+    int i;
+
+    fprintf(body, "X %d %d %d\n", a, run->id, run->n);
+    for (i = 0; i < run->n; i++) {
+        live -= sizes[run->id + i];
+        free_ids[num_free_ids++] = run->id + i;
+    }
+    /* reserved ids the arena did not get to are single ids now */
+    for (; i < run->cap; i++)
+        free_ids[num_free_ids++] = run->id + i;
+    run->n = 0;
+    num_ops++;
+}
+
+/*
+ * make_room - Free blocks early until size more bytes fit under max_live:
+ *     first those due soonest, then queued messages, then buffers, then
+ *     batches and arenas
+ */
+static void make_room(size_t size)
+{
+    int b, a;
+
+    while (live + size > max_live && num_events > 0)
+        emit_free(pop_event());
+    while (live + size > max_live && queue_len > 0) {
+        emit_free(queue[queue_head]);
+        queue_head = (queue_head + 1) % (QUEUE_DEPTH + 1);
+        queue_len--;
+    }
+    for (b = 0; live + size > max_live && b < GROW_BUFS; b++) {
+        if (grow_ids[b] >= 0) {
+            emit_free(grow_ids[b]);
+            grow_ids[b] = -1;
+        }
+    }
+    while (live + size > max_live && batch_len > 0) {
+        emit_batch_free(&batches[batch_head]);
+        batch_head = (batch_head + 1) % (BATCH_DEPTH + 1);
+        batch_len--;
+    }
+    for (a = 0; live + size > max_live && a < ARENAS; a++)
+        if (arenas[a].n > 0)
+            emit_arena_reset(a);
+}
+
+/*
+ * alloc_for - Allocate size bytes, to be freed lifetime steps from now
+ */
+static void alloc_for(size_t size, double lifetime)
+{
+    int id;
+
+    make_room(size);
+    id = new_id();
+    emit_alloc(id, size);
+    push_event(step + 1 + (unsigned long)lifetime, id);
+}
+
+/*
+ * The patterns, one step each
+ */
+static void step_bimodal(void)
+{
+    size_t size = (rand_unit() < 0.9) ? rand_range(8, 128)
+                                      : rand_range(4 << 10, 64 << 10);
+    alloc_for(size, -50.0 * log(rand_unit()));
+}
+
+static void step_queue(void)
+{
+    size_t size = rand_range(64, 512);
+    int id;
+
+    if (queue_len == QUEUE_DEPTH) {
+        emit_free(queue[queue_head]);
+        queue_head = (queue_head + 1) % (QUEUE_DEPTH + 1);
+        queue_len--;
+    }
+    make_room(size);
+    id = new_id();
+    emit_alloc(id, size);
+    queue[(queue_head + queue_len++) % (QUEUE_DEPTH + 1)] = id;
+}
+
+static void step_powerlaw(void)
+{
+    alloc_for(rand_log(16, 64 << 10), pow(rand_unit(), -1.0 / 1.2));
+}
+
+static void step_growing(void)
+{
+    int b = rand_u64() % GROW_BUFS;
+    int id = grow_ids[b];
+    size_t size;
+
+    if (id < 0) {
+        size = rand_range(64, 1024);
+        make_room(size);
+        grow_ids[b] = id = new_id();
+        emit_alloc(id, size);
+    } else if (sizes[id] > GROW_MAX) {
+        emit_free(id);
+        grow_ids[b] = -1;
+    } else {
+        size = sizes[id] + sizes[id] * rand_range(5, 25) / 100;
+        make_room(size - sizes[id]);
+        if (grow_ids[b] == id) /* make_room may have freed it */
+            emit_realloc(id, size);
+    }
+}
+
+static void step_batch(void)
+{
+    int n = rand_range(8, 64);
+    size_t size = rand_range(16, 256);
+    run_t *run;
+
+    if (batch_len == BATCH_DEPTH) {
+        emit_batch_free(&batches[batch_head]);
+        batch_head = (batch_head + 1) % (BATCH_DEPTH + 1);
+        batch_len--;
+    }
+    make_room(n * size);
+    run = &batches[(batch_head + batch_len++) % (BATCH_DEPTH + 1)];
+    run->id = new_ids(n);
+    run->n = run->cap = n;
+    emit_batch(run->id, n, size);
+}
+
+static void step_arena(void)
+{
+    int a = rand_u64() % ARENAS;
+    run_t *run = &arenas[a];
+    size_t size = rand_range(16, 256);
+
+    make_room(size);
+    if (run->n == 0) {
+        run->cap = rand_range(16, 512);
+        run->id = new_ids(run->cap);
+    }
+    emit_arena_alloc(a, run->id + run->n++, size);
+    if (run->n == run->cap)
+        emit_arena_reset(a);
+}
+
+/*
+ * parse_spec - Read "pattern:share,..." into shares
+ */
+static void parse_spec(char *spec, double *shares)
+{
+    char *tok, *colon;
+    int p;
+
+    for (tok = strtok(spec, ","); tok; tok = strtok(NULL, ",")) {
+        if ((colon = strchr(tok, ':')) != NULL)
+            *colon = '\0';
+        for (p = 0; p < NUM_PATTERNS; p++)
+            if (!strcmp(tok, pattern_names[p]))
+                break;
+        if (p == NUM_PATTERNS) {
+            fprintf(stderr, "gentrace: unknown pattern %s\n", tok);
+            exit(1);
+        }
+        shares[p] = colon ? atof(colon + 1) : 1.0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    char buf[MAXLINE];
+    char spec[MAXLINE] = "bimodal:4,queue:2,powerlaw:3,growing:1";
+    char *outname = NULL;
+    unsigned long long seed = 1;
+    unsigned long target = 100000;
+    double shares[NUM_PATTERNS] = {0}, total = 0, u;
+    FILE *out;
+    size_t n;
+    int p, b;
+
+    while ((c = getopt(argc, argv, "hs:n:m:o:p:")) != EOF) {
+        switch (c) {
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'n':
+            target = (unsigned long)atof(optarg);
+            break;
+        case 'm':
+            max_live = (size_t)atof(optarg);
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        case 'p':
+            strncpy(spec, optarg, MAXLINE - 1);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    parse_spec(spec, shares);
+    for (p = 0; p < NUM_PATTERNS; p++)
+        total += shares[p];
+    if (total <= 0)
+        app_error("the spec gives no pattern a share");
+
+    rng_state = seed ? seed : 1;
+    for (b = 0; b < GROW_BUFS; b++)
+        grow_ids[b] = -1;
+    if ((body = tmpfile()) == NULL)
+        app_error("cannot create a temporary file");
+
+    /* Generate the ops, freeing blocks as they become due */
+    while (num_ops < target) {
+        while (num_events > 0 && events[0].due <= step)
+            emit_free(pop_event());
+
+        u = rand_unit() * total;
+        for (p = 0; p < NUM_PATTERNS - 1 && u >= shares[p]; p++)
+            u -= shares[p];
+        switch (p) {
+        case BIMODAL:  step_bimodal();  break;
+        case QUEUE:    step_queue();    break;
+        case POWERLAW: step_powerlaw(); break;
+        case GROWING:  step_growing();  break;
+        case BATCH:    step_batch();    break;
+        default:       step_arena();    break;
+        }
+    }
+
+    /* Free all that is still live */
+    max_live = 0;
+    make_room(0);
+
+    /* Header first, then the ops */
+    if (outname == NULL)
+        out = stdout;
+    else if ((out = fopen(outname, "w")) == NULL)
+        app_error("cannot open the output file");
+    fprintf(out, "0\n%d\n%lu\n0\n", max_id + 1, num_ops);
+    rewind(body);
+    while ((n = fread(buf, 1, sizeof(buf), body)) > 0)
+        fwrite(buf, 1, n, out);
+    fclose(body);
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace [-h] [-s <seed>] [-n <ops>] [-m <bytes>] [-o <file>] [-p <spec>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-s <seed>  Seed of the random numbers (default 1).\n");
+    fprintf(stderr, "\t-n <ops>   Write about this many ops (default 1e5).\n");
+    fprintf(stderr, "\t-m <bytes> Keep at most this much payload live (default 32 MB).\n");
+    fprintf(stderr, "\t-o <file>  Write the trace to <file> instead of stdout.\n");
+    fprintf(stderr, "\t-p <spec>  Mix of patterns, as pattern:share,...\n");
+    fprintf(stderr, "\t           Patterns: bimodal, queue, powerlaw, growing,\n");
+    fprintf(stderr, "\t           batch, arena.\n");
+}
+
+/*
+ * app_error - Report an error and exit
+ */
+static void app_error(const char *msg)
+{
+    fprintf(stderr, "gentrace: %s\n", msg);
+    exit(1);
+}
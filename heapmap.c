@@ -0,0 +1,353 @@
+/*
+ * heapmap.c - draw the heap snapshots written by mdriver -m
+ *
+ * usage: heapmap [-h] [-w <width>] [-n <rows>] [-o <file.png>] <file.hmap>
+ *
+ * Every snapshot becomes one row, time running downwards. The width
+ * spans the largest heap of all snapshots, so growth shows as well as
+ * fragmentation; each column shows how much of its address range is
+ * allocated. Without -o the map is drawn in ASCII, from '_' (all free)
+ * to '@' (all allocated), blank past the brk, and each row ends with
+ * the number of free blocks and the fragmentation, 1 - largest free
+ * block / free bytes. With -o it is written as a PNG image: white is
+ * free, blue allocated, grey past the brk.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "heapmap.h"
+
+#define RAMP "_.:-=+*#%@"  /* ASCII density, from free to allocated */
+#define RAMP_LEVELS 10
+#define PNG_MIN_HEIGHT 400 /* rows are repeated up to this height */
+
+/* Global variables */
+static int width = 0;              /* columns, 0 for the default */
+static int max_rows = 0;           /* snapshots drawn, 0 for all */
+static double *alloc_bytes;        /* allocated bytes in each column */
+static double *heap_bytes;         /* bytes below the brk in each column */
+
+static void app_error(const char *msg);
+
+/*
+ * read_snapshot - read the next snapshot into *hdr and *blocks,
+ *     growing *blocks as needed; returns 0 at the end of the file
+ */
+static int read_snapshot(FILE *f, hmap_header_t *hdr, hmap_block_t **blocks,
+                         size_t *cap)
+{
+    if (fread(hdr, sizeof(*hdr), 1, f) != 1)
+        return 0;
+    if (hdr->magic != HMAP_MAGIC)
+        app_error("not a heap map");
+    if (hdr->num_blocks > *cap) {
+        *cap = hdr->num_blocks;
+        if ((*blocks = realloc(*blocks, *cap * sizeof(hmap_block_t))) == NULL)
+            app_error("out of memory");
+    }
+    if (fread(*blocks, sizeof(hmap_block_t), hdr->num_blocks, f) !=
+        hdr->num_blocks)
+        app_error("truncated heap map");
+    return 1;
+}
+
+/*
+ * fill_columns - spread the heap and the allocated bytes of a snapshot
+ *     over the columns, each covering scale bytes
+ */
+static void fill_columns(const hmap_header_t *hdr, const hmap_block_t *blocks,
+                         double scale)
+{
+    size_t lo, hi, c, end;
+    uint32_t i;
+
+    memset(alloc_bytes, 0, width * sizeof(double));
+    memset(heap_bytes, 0, width * sizeof(double));
+
+    for (c = 0; c < (size_t)width && c * scale < hdr->heap_size; c++)
+        heap_bytes[c] = ((c + 1) * scale < hdr->heap_size)
+                            ? scale : hdr->heap_size - c * scale;
+
+    for (i = 0; i < hdr->num_blocks; i++) {
+        if (!HMAP_ALLOC(blocks[i].info))
+            continue;
+        lo = blocks[i].offset;
+        hi = lo + HMAP_SIZE(blocks[i].info);
+        for (c = (size_t)(lo / scale); c < (size_t)width && lo < hi; c++) {
+            end = (size_t)((c + 1) * scale);
+            end = end < hi ? end : hi;
+            alloc_bytes[c] += end - lo;
+            lo = end;
+        }
+    }
+}
+
+/*
+ * fragmentation - 1 - largest free block / free bytes of a snapshot,
+ *     and the number of free blocks
+ */
+static double fragmentation(const hmap_header_t *hdr,
+                            const hmap_block_t *blocks, unsigned *num_free)
+{
+    size_t free_bytes = 0, largest = 0, size;
+    uint32_t i;
+
+    *num_free = 0;
+    for (i = 0; i < hdr->num_blocks; i++) {
+        if (HMAP_ALLOC(blocks[i].info))
+            continue;
+        size = HMAP_SIZE(blocks[i].info);
+        free_bytes += size;
+        largest = size > largest ? size : largest;
+        (*num_free)++;
+    }
+    return free_bytes ? 1.0 - (double)largest / free_bytes : 0.0;
+}
+
+/*
+ * PNG output, with the image data in uncompressed deflate blocks so that
+ * no library is needed
+ */
+static uint32_t crc_table[256];
+
+static void crc_init(void)
+{
+    uint32_t c;
+    int n, k;
+
+    for (n = 0; n < 256; n++) {
+        for (c = n, k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc(uint32_t c, const unsigned char *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        c = crc_table[(c ^ buf[i]) & 0xff] ^ (c >> 8);
+    return c;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/*
+ * png_chunk - write one chunk: length, type, data and CRC
+ */
+static void png_chunk(FILE *f, const char *type, const unsigned char *data,
+                      size_t len)
+{
+    unsigned char buf[4];
+    uint32_t c;
+
+    put32(buf, len);
+    fwrite(buf, 1, 4, f);
+    fwrite(type, 1, 4, f);
+    fwrite(data, 1, len, f);
+    c = crc(0xffffffffu, (const unsigned char *)type, 4);
+    c = crc(c, data, len) ^ 0xffffffffu;
+    put32(buf, c);
+    fwrite(buf, 1, 4, f);
+}
+
+/*
+ * png_write - write an RGB image of w x h pixels
+ */
+static void png_write(FILE *f, const unsigned char *rgb, int w, int h)
+{
+    static const unsigned char sig[8] = {137, 'P', 'N', 'G', 13, 10, 26, 10};
+    size_t row = 3 * (size_t)w + 1, raw_len = row * h, pos, n, i;
+    unsigned char ihdr[13], *raw, *z, *q;
+    uint32_t a = 1, b = 0;
+    int y;
+
+    /* filter byte 0 (none) in front of every row */
+    if ((raw = malloc(raw_len)) == NULL)
+        app_error("out of memory");
+    for (y = 0; y < h; y++) {
+        raw[y * row] = 0;
+        memcpy(raw + y * row + 1, rgb + (size_t)y * 3 * w, 3 * (size_t)w);
+    }
+
+    /* zlib stream of stored blocks of at most 65535 bytes */
+    if ((z = malloc(raw_len + 5 * (raw_len / 65535 + 1) + 6)) == NULL)
+        app_error("out of memory");
+    q = z;
+    *q++ = 0x78;
+    *q++ = 0x01;
+    for (pos = 0; pos < raw_len || pos == 0; pos += n) {
+        n = raw_len - pos < 65535 ? raw_len - pos : 65535;
+        *q++ = (pos + n == raw_len);
+        *q++ = n & 0xff;
+        *q++ = n >> 8;
+        *q++ = ~n & 0xff;
+        *q++ = (~n >> 8) & 0xff;
+        memcpy(q, raw + pos, n);
+        q += n;
+        if (n == 0)
+            break;
+    }
+    for (i = 0; i < raw_len; i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32(q, b << 16 | a);
+    q += 4;
+
+    put32(ihdr, w);
+    put32(ihdr + 4, h);
+    ihdr[8] = 8;   /* bit depth */
+    ihdr[9] = 2;   /* RGB */
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    crc_init();
+    fwrite(sig, 1, 8, f);
+    png_chunk(f, "IHDR", ihdr, 13);
+    png_chunk(f, "IDAT", z, q - z);
+    png_chunk(f, "IEND", NULL, 0);
+
+    free(raw);
+    free(z);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *f, *out;
+    char *png = NULL;
+    hmap_header_t hdr;
+    hmap_block_t *blocks = NULL;
+    size_t cap = 0, max_heap = 0;
+    unsigned char *rgb = NULL, *px;
+    unsigned num_free;
+    int num_snaps = 0, snap, rows, row, every, repeat, c, k;
+    double scale, frac, frag;
+
+    while ((c = getopt(argc, argv, "hw:n:o:")) != EOF) {
+        switch (c) {
+        case 'w':
+            width = atoi(optarg);
+            break;
+        case 'n':
+            max_rows = atoi(optarg);
+            break;
+        case 'o':
+            png = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: heapmap [-h] [-w <width>] [-n <rows>] "
+                    "[-o <file.png>] <file.hmap>\n");
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (optind >= argc)
+        app_error("no heap map given");
+    if ((f = fopen(argv[optind], "rb")) == NULL)
+        app_error("cannot open the heap map");
+
+    /* First pass: count the snapshots and find the largest heap */
+    while (read_snapshot(f, &hdr, &blocks, &cap)) {
+        num_snaps++;
+        max_heap = hdr.heap_size > max_heap ? hdr.heap_size : max_heap;
+    }
+    if (num_snaps == 0)
+        app_error("empty heap map");
+    rewind(f);
+
+    if (width <= 0)
+        width = png ? 1024 : 64;
+    if (max_rows <= 0)
+        max_rows = png ? num_snaps : 48;
+    every = (num_snaps + max_rows - 1) / max_rows;
+    rows = (num_snaps + every - 1) / every;
+    scale = (double)max_heap / width;
+
+    alloc_bytes = malloc(width * sizeof(double));
+    heap_bytes = malloc(width * sizeof(double));
+    if (png)
+        rgb = malloc((size_t)rows * width * 3);
+    if (!alloc_bytes || !heap_bytes || (png && !rgb))
+        app_error("out of memory");
+
+    if (!png)
+        printf("%10s  %-*s %7s %6s\n", "op", width, "heap (largest "
+               "is the full width)", "free", "frag");
+
+    /* Second pass: draw every every-th snapshot */
+    for (snap = 0, row = 0; read_snapshot(f, &hdr, &blocks, &cap); snap++) {
+        if (snap % every != 0)
+            continue;
+        fill_columns(&hdr, blocks, scale);
+        if (png) {
+            px = rgb + (size_t)row * width * 3;
+            for (c = 0; c < width; c++, px += 3) {
+                if (heap_bytes[c] == 0) {
+                    px[0] = px[1] = px[2] = 200;
+                } else {
+                    frac = alloc_bytes[c] / heap_bytes[c];
+                    px[0] = 255 - frac * (255 - 30);
+                    px[1] = 255 - frac * (255 - 60);
+                    px[2] = 255 - frac * (255 - 140);
+                }
+            }
+        } else {
+            printf("%10u  ", hdr.op);
+            for (c = 0; c < width; c++) {
+                if (heap_bytes[c] == 0)
+                    putchar(' ');
+                else
+                    putchar(RAMP[(int)(alloc_bytes[c] / heap_bytes[c] *
+                                       (RAMP_LEVELS - 1) + 0.5)]);
+            }
+            frag = fragmentation(&hdr, blocks, &num_free);
+            printf(" %7u %5.1f%%\n", num_free, 100.0 * frag);
+        }
+        row++;
+    }
+    fclose(f);
+
+    if (png) {
+        /* repeat the rows of a short map so that it stays visible */
+        repeat = rows < PNG_MIN_HEIGHT ? PNG_MIN_HEIGHT / rows : 1;
+        if (repeat > 1) {
+            unsigned char *tall = malloc((size_t)rows * repeat * width * 3);
+            if (tall == NULL)
+                app_error("out of memory");
+            for (row = 0; row < rows; row++)
+                for (k = 0; k < repeat; k++)
+                    memcpy(tall + ((size_t)row * repeat + k) * width * 3,
+                           rgb + (size_t)row * width * 3, (size_t)width * 3);
+            free(rgb);
+            rgb = tall;
+            rows *= repeat;
+        }
+        if ((out = fopen(png, "wb")) == NULL)
+            app_error("cannot open the PNG file");
+        png_write(out, rgb, width, rows);
+        fclose(out);
+    }
+
+    free(blocks);
+    free(rgb);
+    free(alloc_bytes);
+    free(heap_bytes);
+    return 0;
+}
+
+/*
+ * app_error - Report an error and exit
+ */
+static void app_error(const char *msg)
+{
+    fprintf(stderr, "heapmap: %s\n", msg);
+    exit(1);
+}
@@ -0,0 +1,31 @@
+/*
+ * heapmap.h - snapshots of the heap written by mdriver -m and drawn by
+ *             heapmap
+ *
+ * A snapshot is an hmap_header_t followed by num_blocks hmap_block_t,
+ * one per block in address order. A file holds the snapshots of one
+ * trace, one after the other.
+ */
+#include <stdint.h>
+
+#define HMAP_MAGIC 0x50414d48u  /* "HMAP" */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t op;          /* ops of the trace done before the snapshot */
+    uint32_t heap_size;   /* bytes between the heap start and its brk */
+    uint32_t num_blocks;
+} hmap_header_t;
+
+/* A block in 8 bytes: its offset from the heap start, and its size / 8,
+   size class and alloc bit packed into info */
+typedef struct {
+    uint32_t offset;
+    uint32_t info;
+} hmap_block_t;
+
+#define HMAP_INFO(size, cls, alloc) \
+    ((uint32_t)((size) >> 3) << 8 | (uint32_t)(cls) << 1 | ((alloc) != 0))
+#define HMAP_SIZE(info)  ((size_t)((info) >> 8) << 3)
+#define HMAP_CLASS(info) (((info) >> 1) & 0x7f)
+#define HMAP_ALLOC(info) ((info) & 1)
@@ -0,0 +1,97 @@
+/*
+ * lathist.c - log-bucketed latency histograms
+ *
+ * Values below 2^LH_SUB_BITS have a bucket each. Above, every power of
+ * two is split into 2^LH_SUB_BITS buckets, so that a bucket is never
+ * wider than 1/16 of the values in it. Recording is a few shifts and
+ * an increment; nothing is allocated after the histogram is set up.
+ */
+#include <string.h>
+
+#include "lathist.h"
+
+#define SUB (1 << LH_SUB_BITS)
+
+/*
+ * bucket - index of the bucket holding value v
+ */
+static int bucket(unsigned long long v)
+{
+    int e;
+
+    if (v < SUB)
+        return (int)v;
+    e = 63 - __builtin_clzll(v);
+    return ((e - LH_SUB_BITS + 1) << LH_SUB_BITS) +
+           (int)((v >> (e - LH_SUB_BITS)) & (SUB - 1));
+}
+
+/*
+ * bucket_high - largest value in bucket i
+ */
+static unsigned long long bucket_high(int i)
+{
+    int e;
+
+    if (i < SUB)
+        return i;
+    e = (i >> LH_SUB_BITS) + LH_SUB_BITS - 1;
+    return ((unsigned long long)(SUB + (i & (SUB - 1)) + 1)
+            << (e - LH_SUB_BITS)) - 1;
+}
+
+/*
+ * lh_reset - empty a histogram
+ */
+void lh_reset(lathist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/*
+ * lh_record - count one sample
+ */
+void lh_record(lathist_t *h, unsigned long long v, int tag)
+{
+    int i;
+
+    h->counts[bucket(v)]++;
+    h->total++;
+    if (v > h->max)
+        h->max = v;
+
+    /* keep the slowest samples, by insertion */
+    if (v <= h->worst[LH_WORST - 1])
+        return;
+    for (i = LH_WORST - 1; i > 0 && v > h->worst[i - 1]; i--) {
+        h->worst[i] = h->worst[i - 1];
+        h->worst_tag[i] = h->worst_tag[i - 1];
+    }
+    h->worst[i] = v;
+    h->worst_tag[i] = tag;
+}
+
+/*
+ * lh_percentile - upper bound of the bucket holding the p-quantile,
+ *     never more than the largest sample
+ */
+unsigned long long lh_percentile(const lathist_t *h, double p)
+{
+    unsigned long long rank, seen = 0, high;
+    int i;
+
+    if (h->total == 0)
+        return 0;
+    rank = (unsigned long long)(p * h->total);
+    if (rank >= h->total)
+        rank = h->total - 1;
+
+    for (i = 0; i < LH_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen > rank) {
+            high = bucket_high(i);
+            return high < h->max ? high : h->max;
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,30 @@
+/* Log-bucketed latency histograms, in the manner of HdrHistogram */
+
+#define LH_SUB_BITS 4                      /* sub-buckets per power of 2 */
+#define LH_BUCKETS (64 << LH_SUB_BITS)     /* enough for any 64-bit value */
+#define LH_WORST 4                         /* slowest samples remembered */
+
+typedef struct {
+    unsigned long long counts[LH_BUCKETS];
+    unsigned long long total;              /* number of samples */
+    unsigned long long max;                /* largest sample */
+    unsigned long long worst[LH_WORST];    /* slowest samples, descending */
+    int worst_tag[LH_WORST];               /* caller's tag of each */
+} lathist_t;
+
+/* Read the cycle counter, after all earlier instructions are done */
+static inline unsigned long long lh_rdtscp(void)
+{
+    unsigned hi, lo, aux;
+
+    asm volatile("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+void lh_reset(lathist_t *h);
+
+/* Record sample v; tag identifies it among the slowest */
+void lh_record(lathist_t *h, unsigned long long v, int tag);
+
+/* Value below which fraction p of the samples lie, within 1/16 */
+unsigned long long lh_percentile(const lathist_t *h, double p);
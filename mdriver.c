@@ -10,6 +10,8 @@
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
+#include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -24,6 +26,10 @@
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "numa.h"
+#include "perfctr.h"
+#include "lathist.h"
+#include "heapmap.h"
 
 /**********************
  * Constants and macros
@@ -33,6 +39,23 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define HANDOFF        4 /* in -T mode, every HANDOFF-th block is freed
+                            by another thread */
+
+#define STREAM_CHUNK (1<<16) /* ops per chunk of a streamed trace (-R) */
+#define FS_OBJS     1024 /* objects per thread of the false sharing run */
+#define FS_SIZE       24 /* payload bytes of each such object */
+#define FS_ROUNDS   4096 /* times each thread writes all of its objects */
+#define FS_LINE       64 /* cache line size assumed to count shared lines */
+#define SCALE_THREADS 64 /* most threads of the scaling replay (-X) */
+#define PC_OBJS  (1<<20) /* objects of the producer/consumer run (-Q) */
+#define PC_RING     1024 /* slots of the ring of each consumer */
+
+/* kinds of op told apart by the latency replay (-L) */
+#define LAT_MALLOC     0 /* malloc, malloc_batch and arena_alloc */
+#define LAT_FREE       1 /* free, free_batch and arena_reset */
+#define LAT_REALLOC    2
+#define LAT_KINDS      3
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
@@ -64,9 +87,13 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
+    enum { ALLOC, FREE, REALLOC,
+           ALLOC_BATCH, FREE_BATCH,
+           ARENA_ALLOC, ARENA_RESET } type; /* type of request */
     int index;                        /* index for free() to use later */
     size_t size;                      /* byte size of alloc/realloc request */
+    int count;                        /* number of ids in a batch request */
+    int arena;                        /* arena of an arena request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -75,8 +102,12 @@ typedef struct {
     int ignore_ranges;   /* don't check ranges (i.e. this is too big) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
+    int num_reqs;        /* ... counting each block of a batch request */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    void **batch;        /* scratch array for batch requests */
+    int num_arenas;      /* number of arenas used by arena requests */
+    mm_arena_t **arenas; /* array of arenas, created on first use */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
     int *block_rand_base;/* index into random_data, if debug is on */
@@ -106,6 +137,24 @@ typedef struct {
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* defined only for the multi-threaded replay (-T) */
+    int thread_valid;            /* no heap ran out of memory */
+    double thread_secs;          /* wall time of the threaded replay */
+    unsigned long local_access;  /* blocks touched from their own node */
+    unsigned long remote_access; /* blocks touched from another node */
+    numa_stats_t numa;           /* where blocks were freed from */
+
+    /* defined only if hardware events are counted (-M) */
+    long long counts[PC_NUM_EVENTS]; /* in one speed run, -1 if not
+                                        countable */
+
+    /* defined only for the latency replay (-L) */
+    lathist_t *lat;              /* one histogram per kind of op */
+    lathist_t *lat_base;         /* the same on the ordered lists, with -E */
+
+    /* defined only if free list walks are reported (-W) */
+    mm_list_stats_t walks;       /* in the utilization run */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
@@ -144,6 +193,59 @@ int onetime_flag = 0;
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* if set, replay batch requests as one call per block (set by -b) */
+static int split_batches = 0;
+
+/* if set, pass the payload size to the allocator on free (set by -S) */
+static int sized_free = 0;
+
+/* if set, replay arena requests as one call per block (set by -a) */
+static int split_arenas = 0;
+
+/* number of heaps each trace is spread over (set by -H) */
+static int num_heaps = 1;
+
+/* block index i lives in heaps[i % num_heaps]; NULL is the default heap */
+static mm_heap_t **heaps = NULL;
+
+/* number of threads replaying each trace on per-node heaps (set by -T) */
+static int num_threads = 0;
+
+/* number of NUMA nodes to simulate, 0 for the machine's (set by -N) */
+static int num_nodes = 0;
+
+/* if set, count hardware events of each speed run (set by -M) */
+static int count_events = 0;
+
+/* if set, time every op of a further replay of each trace (set by -L) */
+static int latency = 0;
+
+/* if set, replay each trace once while streaming it in (set by -R) */
+static int stream = 0;
+
+/* if set, snapshot the heap every snap_every ops of the checked replay
+   into <trace>.hmap (set by -m) */
+static int snap_every = 0;
+static FILE *snap_file = NULL;
+
+/* if set, the heaps run in TLSF mode (set by -E) */
+static int tlsf = 0;
+
+/* if set, report how far each trace walked the free lists (set by -W) */
+static int list_walks = 0;
+
+/* number of threads of the false sharing benchmark, run instead of the
+   traces (set by -F) */
+static int fs_threads = 0;
+
+/* if set, replay the traces on a concurrent heap with 1 to SCALE_THREADS
+   threads instead (set by -X) */
+static int scaling = 0;
+
+/* number of consumer threads of the producer/consumer benchmark, run
+   instead of the traces (set by -Q) */
+static int pc_threads = 0;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -185,12 +287,35 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
+static mm_heap_t *heap_of(int index);
+static int mm_init_heaps(void);
+static char *mm_malloc_block(int index, size_t size);
+static char *mm_realloc_block(int index, char *oldp, size_t size);
+static void mm_free_block(trace_t *trace, int index);
+static int mm_batch_alloc(trace_t *trace, int opnum);
+static void mm_batch_free(trace_t *trace, int opnum);
+static char *mm_arena_op_alloc(trace_t *trace, int opnum);
+static void mm_arena_op_reset(trace_t *trace, int opnum);
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_threads(trace_t *trace, stats_t *stats);
+static void eval_false_sharing(void);
+static void eval_scaling(int num_tracefiles, char **tracefiles);
+static void eval_producer_consumer(void);
+static void eval_mm_latency(trace_t *trace, lathist_t *lat);
+static inline void replay_op(trace_t *trace, int i);
+static void snap_open(const char *tracefile);
+static void snap_heap(int opnum);
+static void eval_mm_stream(const char *tracedir, const char *filename,
+                           stats_t *stats);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printthreadresults(int n, stats_t *stats);
+static void printcounts(stats_t *stats);
+static void printlatresults(int n, stats_t *stats);
+static void printwalkresults(int n, stats_t *stats);
 static void usage(void);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -216,11 +341,27 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     volatile int i;
     volatile int timed_out = 0;
 
+    if ((heaps = (mm_heap_t **)calloc(num_heaps, sizeof(mm_heap_t *))) == NULL)
+        unix_error("heaps calloc in run_tests failed");
+
     for (i=0; i < num_tracefiles; i++) {
+        int h;
+
         /* initialize simulated memory system in memlib.c *
          * start each trace with a clean system */
         mem_init();
 
+        /* a streamed trace is replayed once, straight from its file */
+        if (stream) {
+            eval_mm_stream(tracedir, tracefiles[i], &mm_stats[i]);
+            mem_deinit();
+            continue;
+        }
+
+        for (h = 1; h < num_heaps; h++)
+            if ((heaps[h] = mm_heap_create()) == NULL)
+                app_error("mm_heap_create failed in run_tests\n");
+
         /* handle timeouts */
         if(setjmp(timeout_jmpbuf) != 0) {
             timed_out = 1;
@@ -229,13 +370,19 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         trace_t *trace;
         trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
         strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
+        mm_stats[i].ops = trace->num_reqs;
         if(timed_out) {
             mm_stats[i].valid = 0;
         } else {
             if (verbose > 1)
                 printf("Checking mm_malloc for correctness, ");
+            if (snap_every > 0)
+                snap_open(tracefiles[i]);
             mm_stats[i].valid = eval_mm_valid(trace, &ranges);
+            if (snap_file) {
+                fclose(snap_file);
+                snap_file = NULL;
+            }
 
             if (onetime_flag) {
                 free_trace(trace);
@@ -246,16 +393,42 @@ static void run_tests(int num_tracefiles, const char *tracedir,
             if (verbose > 1)
                 printf("efficiency, ");
             mm_stats[i].util = eval_mm_util(trace, i);
+            if (list_walks)
+                mm_list_stats(&mm_stats[i].walks);
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
             mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            if (count_events)
+                pc_measure(eval_mm_speed, speed_params, mm_stats[i].counts);
+            if (num_threads > 0)
+                eval_mm_threads(trace, &mm_stats[i]);
+            if (latency) {
+                mm_stats[i].lat =
+                    (lathist_t *)malloc(LAT_KINDS * sizeof(lathist_t));
+                if (mm_stats[i].lat == NULL)
+                    unix_error("malloc failed in run_tests");
+                eval_mm_latency(trace, mm_stats[i].lat);
+
+                /* with TLSF, the ordered lists serve as the baseline */
+                if (tlsf) {
+                    mm_stats[i].lat_base =
+                        (lathist_t *)malloc(LAT_KINDS * sizeof(lathist_t));
+                    if (mm_stats[i].lat_base == NULL)
+                        unix_error("malloc failed in run_tests");
+                    mm_set_tlsf(0);
+                    eval_mm_latency(trace, mm_stats[i].lat_base);
+                    mm_set_tlsf(1);
+                }
+            }
         }
 
         free_trace(trace);
 
         /* clean up memory system */
+        for (h = 1; h < num_heaps; h++)
+            mm_heap_destroy(heaps[h]);
         mem_deinit();
     }
 }
@@ -291,7 +464,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpVAlD")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpVAlDbSaH:T:N:PMLRm:CF:EBWOGXQ:")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -352,6 +525,93 @@ int main(int argc, char **argv)
             set_timeout = atoi(optarg);
             break;
 
+        case 'b':
+            split_batches = 1;
+            break;
+
+        case 'S':
+            sized_free = 1;
+            break;
+
+        case 'a':
+            split_arenas = 1;
+            break;
+
+        case 'H':
+            num_heaps = atoi(optarg);
+            if (num_heaps < 1)
+                app_error("-H needs at least one heap\n");
+            break;
+
+        case 'T':
+            num_threads = atoi(optarg);
+            break;
+
+        case 'N':
+            num_nodes = atoi(optarg);
+            break;
+
+        case 'P':
+            mem_set_hugepages(1);
+            break;
+
+        case 'M':
+            count_events = 1;
+            break;
+
+        case 'L':
+            latency = 1;
+            break;
+
+        case 'R':
+            stream = 1;
+            break;
+
+        case 'm':
+            snap_every = atoi(optarg);
+            break;
+
+        case 'C':
+            mm_set_cacheline(1);
+            break;
+
+        case 'E':
+            tlsf = 1;
+            mm_set_tlsf(1);
+            break;
+
+        case 'B':
+            mm_set_buddy(1);
+            break;
+
+        case 'W':
+            list_walks = 1;
+            break;
+
+        case 'O':
+            mm_set_split(1);
+            break;
+
+        case 'G':
+            mm_set_sidetable(1);
+            break;
+
+        case 'X':
+            scaling = 1;
+            break;
+
+        case 'F':
+            fs_threads = atoi(optarg);
+            if (fs_threads < 1)
+                app_error("-F needs at least one thread\n");
+            break;
+
+        case 'Q':
+            pc_threads = atoi(optarg);
+            if (pc_threads < 1)
+                app_error("-Q needs at least one thread\n");
+            break;
+
         case 'h': /* Print this message */
             usage();
             exit(0);
@@ -362,12 +622,27 @@ int main(int argc, char **argv)
         }
     }
 
+    if (fs_threads > 0) {
+        eval_false_sharing();
+        exit(0);
+    }
+
+    if (pc_threads > 0) {
+        eval_producer_consumer();
+        exit(0);
+    }
+
     if (tracefiles == NULL) {
         tracefiles = default_tracefiles;
         num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
         printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    if (scaling) {
+        eval_scaling(num_tracefiles, tracefiles);
+        exit(0);
+    }
+
     if(debug_mode != DBG_NONE) {
         init_random_data();
     }
@@ -405,6 +680,9 @@ int main(int argc, char **argv)
                 if (verbose > 1)
                     printf("and performance.\n");
                 libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+                if (count_events)
+                    pc_measure(eval_libc_speed, &speed_params,
+                               libc_stats[i].counts);
             }
             free_trace(trace);
         }
@@ -445,6 +723,23 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (latency) {
+                printf("Latency of mm malloc in cycles%s:\n",
+                       tlsf ? ", on TLSF and on the ordered lists" : "");
+                printlatresults(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (list_walks) {
+                printf("Free list walks of mm malloc:\n");
+                printwalkresults(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (num_threads > 0) {
+                printf("Results for %d threads on per-node heaps:\n",
+                       num_threads);
+                printthreadresults(num_tracefiles, mm_stats);
+                printf("\n");
+            }
         }
     }
 
@@ -606,12 +901,18 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap. Batch and
+       arena requests always use the default heap. */
+    char *heap_lo = (char *)mem_heap_lo(), *heap_hi = (char *)mem_heap_hi();
+    if (heap_of(index) && (lo < heap_lo || lo > heap_hi)) {
+        heap_lo = (char *)mem_region_lo(mm_heap_region(heap_of(index)));
+        heap_hi = (char *)mem_region_hi(mm_heap_region(heap_of(index)));
+    }
+    if ((lo < heap_lo) || (lo > heap_hi) ||
+        (hi < heap_lo) || (hi > heap_hi)) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) lies outside heap (%p:%p)",
-                     lo, hi, mem_heap_lo(), mem_heap_hi());
+                     lo, hi, heap_lo, heap_hi);
         return 0;
     }
 
@@ -754,9 +1055,11 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     FILE *tracefile;
     trace_t *trace;
     char type[MAXLINE];
-    int index, size;
+    int index, size, count;
     int max_index = 0;
-    int op_index;
+    int max_count = 0;
+    int max_arena = -1;
+    int op_index, arena;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -808,6 +1111,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
+    trace->num_reqs = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
         switch(type[0]) {
         case 'a':
@@ -829,10 +1133,48 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             trace->ops[op_index].type = FREE;
             trace->ops[op_index].index = index;
             break;
+        case 'A':
+            r = fscanf(tracefile, "%u %u %u", &index, &count, &size);
+            trace->ops[op_index].type = ALLOC_BATCH;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].count = count;
+            trace->ops[op_index].size = size;
+            max_index = (index + count - 1 > max_index) ?
+                index + count - 1 : max_index;
+            max_count = (count > max_count) ? count : max_count;
+            break;
+        case 'F':
+            r = fscanf(tracefile, "%u %u", &index, &count);
+            trace->ops[op_index].type = FREE_BATCH;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].count = count;
+            max_count = (count > max_count) ? count : max_count;
+            break;
+        case 'x':
+            r = fscanf(tracefile, "%u %u %u", &arena, &index, &size);
+            trace->ops[op_index].type = ARENA_ALLOC;
+            trace->ops[op_index].arena = arena;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            max_index = (index > max_index) ? index : max_index;
+            max_arena = (arena > max_arena) ? arena : max_arena;
+            break;
+        case 'X':
+            r = fscanf(tracefile, "%u %u %u", &arena, &index, &count);
+            trace->ops[op_index].type = ARENA_RESET;
+            trace->ops[op_index].arena = arena;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].count = count;
+            max_arena = (arena > max_arena) ? arena : max_arena;
+            break;
         default:
             app_error("Bogus type character (%c) in tracefile %s\n",
                       type[0], trace->filename);
         }
+        if (type[0] == 'A' || type[0] == 'F' || type[0] == 'X')
+            trace->num_reqs += trace->ops[op_index].count;
+        else
+            trace->num_reqs++;
         op_index++;
         if(op_index == trace->num_ops) break;
     }
@@ -840,10 +1182,22 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
 
+    /* batch frees hand the allocator a copy it is free to reorder */
+    if ((trace->batch =
+         (void **)calloc(max_count, sizeof(void *))) == NULL && max_count)
+        unix_error("malloc 6 failed in read_trace");
+
+    /* arenas live in the mm heap, so they are created during replay */
+    trace->num_arenas = max_arena + 1;
+    if ((trace->arenas = (mm_arena_t **)calloc(trace->num_arenas,
+                                              sizeof(mm_arena_t *))) == NULL
+        && trace->num_arenas)
+        unix_error("malloc 7 failed in read_trace");
+
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
     stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
+    stats->ops = trace->num_reqs;
 
     return trace;
 }
@@ -855,11 +1209,12 @@ static void reinit_trace(trace_t *trace)
 {
     memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
     memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
+    memset(trace->arenas, 0, trace->num_arenas * sizeof(*trace->arenas));
     /* block_rand_base is unused if size is zero */
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
+ * free_trace - Free the trace record and the six arrays it points
  *              to, all of which were allocated in read_trace().
  */
 static void free_trace(trace_t *trace)
@@ -868,6 +1223,8 @@ static void free_trace(trace_t *trace)
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
+    free(trace->batch);
+    free(trace->arenas);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -876,13 +1233,155 @@ static void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * heap_of - The heap block index lives in, NULL for the default heap
+ */
+static mm_heap_t *heap_of(int index)
+{
+    return (num_heaps > 1 && index >= 0) ? heaps[index % num_heaps] : NULL;
+}
+
+/*
+ * mm_init_heaps - Initialize the default heap with mm_init and empty
+ *     every other heap. Returns -1 on failure.
+ */
+static int mm_init_heaps(void)
+{
+    int h;
+
+    if (mm_init() < 0)
+        return -1;
+    for (h = 1; h < num_heaps; h++)
+        if (mm_heap_reset(heaps[h]) < 0)
+            return -1;
+    return 0;
+}
+
+/*
+ * mm_malloc_block, mm_realloc_block - mm_malloc and mm_realloc for
+ *     block index, in the heap it lives in
+ */
+static char *mm_malloc_block(int index, size_t size)
+{
+    if (heap_of(index))
+        return mm_heap_malloc(heap_of(index), size);
+    return mm_malloc(size);
+}
+
+static char *mm_realloc_block(int index, char *oldp, size_t size)
+{
+    if (heap_of(index))
+        return mm_heap_realloc(heap_of(index), oldp, size);
+    return mm_realloc(oldp, size);
+}
+
+/*
+ * mm_free_block - Free block index (NULL if index is -1) with mm_free,
+ *     or with mm_free_sized and its payload size if -S was given.
+ *     Blocks living in a heap other than the default one go back to it.
+ */
+static void mm_free_block(trace_t *trace, int index)
+{
+    char *p = (index < 0) ? NULL : trace->blocks[index];
+
+    if (heap_of(index))
+        mm_heap_free(heap_of(index), p);
+    else if (sized_free)
+        mm_free_sized(p, (index < 0) ? 0 : trace->block_sizes[index]);
+    else
+        mm_free(p);
+}
+
+/*
+ * mm_batch_alloc - Carry out batch request opnum with mm_malloc_batch,
+ *     or with one mm_malloc per block if -b was given. The new blocks
+ *     are stored in trace->blocks. Returns 0 on failure.
+ */
+static int mm_batch_alloc(trace_t *trace, int opnum)
+{
+    int k;
+    int index = trace->ops[opnum].index;
+    int count = trace->ops[opnum].count;
+    size_t size = trace->ops[opnum].size;
+
+    if (!split_batches)
+        return mm_malloc_batch(size, count, (void **)&trace->blocks[index])
+            == (size_t)count;
+
+    for (k = index; k < index + count; k++)
+        if ((trace->blocks[k] = mm_malloc_block(k, size)) == NULL)
+            return 0;
+    return 1;
+}
+
+/*
+ * mm_batch_free - Carry out batch request opnum with mm_free_batch,
+ *     or with one mm_free per block if -b was given.
+ */
+static void mm_batch_free(trace_t *trace, int opnum)
+{
+    int k;
+    int index = trace->ops[opnum].index;
+    int count = trace->ops[opnum].count;
+
+    if (!split_batches) {
+        /* mm_free_batch reorders its argument, so hand it a copy */
+        memcpy(trace->batch, &trace->blocks[index], count * sizeof(void *));
+        mm_free_batch(trace->batch, count);
+        return;
+    }
+
+    for (k = index; k < index + count; k++)
+        mm_free_block(trace, k);
+}
+
+/*
+ * mm_arena_op_alloc - Carry out arena request opnum with mm_arena_alloc,
+ *     creating the arena on first use, or with mm_malloc if -a was given.
+ *     Returns NULL on failure.
+ */
+static char *mm_arena_op_alloc(trace_t *trace, int opnum)
+{
+    int arena = trace->ops[opnum].arena;
+    size_t size = trace->ops[opnum].size;
+
+    if (split_arenas)
+        return mm_malloc_block(trace->ops[opnum].index, size);
+
+    if (trace->arenas[arena] == NULL &&
+        (trace->arenas[arena] = mm_arena_create()) == NULL)
+        return NULL;
+    return mm_arena_alloc(trace->arenas[arena], size);
+}
+
+/*
+ * mm_arena_op_reset - Release every block of arena request opnum with
+ *     mm_arena_reset, or with one mm_free per block if -a was given.
+ */
+static void mm_arena_op_reset(trace_t *trace, int opnum)
+{
+    int k;
+    int index = trace->ops[opnum].index;
+    int count = trace->ops[opnum].count;
+    int arena = trace->ops[opnum].arena;
+
+    if (!split_arenas) {
+        if (trace->arenas[arena])
+            mm_arena_reset(trace->arenas[arena]);
+        return;
+    }
+
+    for (k = index; k < index + count; k++)
+        mm_free_block(trace, k);
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
 static int eval_mm_valid(trace_t *trace, range_t **ranges)
 {
-    int i;
-    int index;
+    int i, k;
+    int index, count;
     size_t size;
     char *newp;
     char *oldp;
@@ -894,7 +1393,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
     reinit_trace(trace);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (mm_init_heaps() < 0) {
         malloc_error(trace, 0, "mm_init failed.");
         return 0;
     }
@@ -904,11 +1403,16 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         index = trace->ops[i].index;
         size = trace->ops[i].size;
 
+        if (snap_file && i % snap_every == 0)
+            snap_heap(i);
+
         if(debug_mode == DBG_EXPENSIVE) {
             range_t *r;
                         
             /* Let the students check their own heap */
             mm_checkheap(verbose);
+            for (k = 1; k < num_heaps; k++)
+                mm_heap_checkheap(heaps[k], verbose);
 
             /* Now check that all our allocated blocks have the right data */
             r = *ranges;
@@ -923,7 +1427,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((p = mm_malloc_block(index, size)) == NULL) {
                 malloc_error(trace, i, "mm_malloc failed.");
                 return 0;
             }
@@ -949,7 +1453,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
 
             /* Call the student's realloc */
             oldp = trace->blocks[index];
-            newp = mm_realloc(oldp, size);
+            newp = mm_realloc_block(index, oldp, size);
             if( (newp == NULL) && (size != 0) ) {
                 malloc_error(trace, i, "mm_realloc failed.");
                 return 0;
@@ -994,7 +1498,63 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
                 p = trace->blocks[index];
                 remove_range(ranges, p);
             }
-            mm_free(p);
+            mm_free_block(trace, index);
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            count = trace->ops[i].count;
+
+            /* Call the student's batch malloc */
+            if (mm_batch_alloc(trace, i) == 0) {
+                malloc_error(trace, i, "mm_malloc_batch failed.");
+                return 0;
+            }
+
+            /* Check every new block, as for a single mm_malloc */
+            for (k = index; k < index + count; k++) {
+                if (add_range(ranges, trace->blocks[k], size, trace, i, k) == 0)
+                    return 0;
+                trace->block_sizes[k] = size;
+                randomize_block(trace, k);
+            }
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            count = trace->ops[i].count;
+
+            /* Remove every region from the list and call student's free */
+            for (k = index; k < index + count; k++) {
+                check_index(trace, i, k);
+                remove_range(ranges, trace->blocks[k]);
+            }
+            mm_batch_free(trace, i);
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_alloc */
+
+            /* Call the student's arena allocator */
+            if ((p = mm_arena_op_alloc(trace, i)) == NULL) {
+                malloc_error(trace, i, "mm_arena_alloc failed.");
+                return 0;
+            }
+
+            /* Check the new block as for mm_malloc */
+            if (add_range(ranges, p, size, trace, i, index) == 0)
+                return 0;
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            randomize_block(trace, index);
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+            count = trace->ops[i].count;
+
+            /* Every block allocated from the arena dies here */
+            for (k = index; k < index + count; k++) {
+                check_index(trace, i, k);
+                remove_range(ranges, trace->blocks[k]);
+            }
+            mm_arena_op_reset(trace, i);
             break;
 
         default:
@@ -1002,11 +1562,74 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         }
 
     }
+    if (snap_file)
+        snap_heap(trace->num_ops);
 
     /* As far as we know, this is a valid malloc package */
     return 1;
 }
 
+/*
+ * Heap snapshots (-m). Every snap_every ops, eval_mm_valid has mm.c walk
+ * the default heap and writes one hmap_block_t per block, 8 bytes each,
+ * so that even a heap of 10^5 blocks takes under a megabyte.
+ */
+static hmap_block_t *snap_blocks = NULL;
+static size_t snap_len = 0, snap_cap = 0;
+
+/*
+ * snap_open - Open <trace>.hmap in the current directory for the
+ *     snapshots of a trace
+ */
+static void snap_open(const char *tracefile)
+{
+    char name[MAXLINE];
+    const char *base = strrchr(tracefile, '/');
+    char *dot;
+
+    strcpy(name, base ? base + 1 : tracefile);
+    if ((dot = strrchr(name, '.')) != NULL)
+        *dot = '\0';
+    strcat(name, ".hmap");
+    if ((snap_file = fopen(name, "wb")) == NULL)
+        unix_error("Could not open %s in snap_open", name);
+}
+
+/*
+ * snap_block - mm_heap_walk callback: append one block to the snapshot
+ */
+static void snap_block(void *arg, size_t offset, size_t size, int alloc,
+                       int cls)
+{
+    if (snap_len == snap_cap) {
+        snap_cap = snap_cap ? 2 * snap_cap : 4096;
+        snap_blocks = realloc(snap_blocks, snap_cap * sizeof(hmap_block_t));
+        if (snap_blocks == NULL)
+            unix_error("realloc failed in snap_block");
+    }
+    snap_blocks[snap_len].offset = offset;
+    snap_blocks[snap_len].info = HMAP_INFO(size, cls, alloc);
+    snap_len++;
+}
+
+/*
+ * snap_heap - Write a snapshot of the default heap, taken before op opnum
+ */
+static void snap_heap(int opnum)
+{
+    hmap_header_t hdr;
+
+    snap_len = 0;
+    mm_heap_walk(snap_block, NULL);
+
+    hdr.magic = HMAP_MAGIC;
+    hdr.op = opnum;
+    hdr.heap_size = mem_heapsize();
+    hdr.num_blocks = snap_len;
+    fwrite(&hdr, sizeof(hdr), 1, snap_file);
+    fwrite(snap_blocks, sizeof(hmap_block_t), snap_len, snap_file);
+}
+
 /*
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
@@ -1021,11 +1644,12 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
  */
 static double eval_mm_util(trace_t *trace, int tracenum)
 {
-    int i;
-    int index;
+    int i, k;
+    int index, count;
     int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
+    size_t heapsize;
     char *p;
     char *newp, *oldp;
 
@@ -1033,7 +1657,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (mm_init_heaps() < 0)
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -1043,7 +1667,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((p = mm_malloc_block(index, size)) == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1061,7 +1685,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             oldsize = trace->block_sizes[index];
 
             oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0) {
+            if ((newp = mm_realloc_block(index, oldp, newsize)) == NULL &&
+                newsize != 0) {
                 app_error("trace %d: mm_realloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1083,11 +1708,64 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 p = trace->blocks[index];
             }
 
-            mm_free(p);
+            mm_free_block(trace, index);
 
             total_size -= size;
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            size = trace->ops[i].size;
+
+            if (mm_batch_alloc(trace, i) == 0) {
+                app_error("trace %d: mm_malloc_batch failed in eval_mm_util",
+                          tracenum);
+            }
+
+            /* Remember sizes */
+            for (k = index; k < index + count; k++)
+                trace->block_sizes[k] = size;
+
+            total_size += count * size;
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+
+            mm_batch_free(trace, i);
+
+            for (k = index; k < index + count; k++)
+                total_size -= trace->block_sizes[k];
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_alloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+
+            if ((p = mm_arena_op_alloc(trace, i)) == NULL) {
+                app_error("trace %d: mm_arena_alloc failed in eval_mm_util",
+                          tracenum);
+            }
+
+            /* Remember region and size */
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+
+            total_size += size;
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+
+            mm_arena_op_reset(trace, i);
+
+            for (k = index; k < index + count; k++)
+                total_size -= trace->block_sizes[k];
+            break;
+
         default:
             app_error("trace %d: Nonexistent request type in eval_mm_util",
                       tracenum);
@@ -1100,7 +1778,12 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 
     printf(".");
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    /* all heaps together make up the footprint */
+    heapsize = mem_heapsize();
+    for (k = 1; k < num_heaps; k++)
+        heapsize += mem_region_size(mm_heap_region(heaps[k]));
+
+    return ((double)max_total_size / (double)heapsize);
 }
 
 
@@ -1110,50 +1793,1067 @@ static double eval_mm_util(trace_t *trace, int tracenum)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
+    int i;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (mm_init_heaps() < 0)
         app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+        replay_op(trace, i);
+}
 
-        case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-                app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
-            break;
+/*
+ * replay_op - Carry out request i of a trace with the mm package,
+ *     without any checks; used by the timed replays
+ */
+static inline void replay_op(trace_t *trace, int i)
+{
+    int index, size, newsize;
+    char *p, *newp, *oldp;
 
-        case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
-                app_error("mm_realloc error in eval_mm_speed");
-            trace->blocks[index] = newp;
-            break;
+    switch (trace->ops[i].type) {
 
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            if(index < 0) {
-                block = 0;
-            } else {
-                block = trace->blocks[index];
+    case ALLOC: /* mm_malloc */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if ((p = mm_malloc_block(index, size)) == NULL)
+            app_error("mm_malloc error in replay_op");
+        trace->blocks[index] = p;
+        if (sized_free)
+            trace->block_sizes[index] = size;
+        break;
+
+    case REALLOC: /* mm_realloc */
+        index = trace->ops[i].index;
+        newsize = trace->ops[i].size;
+        oldp = trace->blocks[index];
+        if ((newp = mm_realloc_block(index, oldp, newsize)) == NULL &&
+            newsize != 0)
+            app_error("mm_realloc error in replay_op");
+        trace->blocks[index] = newp;
+        if (sized_free)
+            trace->block_sizes[index] = newsize;
+        break;
+
+    case FREE: /* mm_free */
+        mm_free_block(trace, trace->ops[i].index);
+        break;
+
+    case ALLOC_BATCH: /* mm_malloc_batch */
+        if (mm_batch_alloc(trace, i) == 0)
+            app_error("mm_malloc_batch error in replay_op");
+        break;
+
+    case FREE_BATCH: /* mm_free_batch */
+        mm_batch_free(trace, i);
+        break;
+
+    case ARENA_ALLOC: /* mm_arena_alloc */
+        index = trace->ops[i].index;
+        if ((p = mm_arena_op_alloc(trace, i)) == NULL)
+            app_error("mm_arena_alloc error in replay_op");
+        trace->blocks[index] = p;
+        if (sized_free)
+            trace->block_sizes[index] = trace->ops[i].size;
+        break;
+
+    case ARENA_RESET: /* mm_arena_reset */
+        mm_arena_op_reset(trace, i);
+        break;
+
+    default:
+        app_error("Nonexistent request type in replay_op");
+    }
+}
+
+/*
+ * eval_mm_latency - Replay a trace once, timing every request on its own
+ *     with rdtscp, into one histogram per kind of op. A batch or an
+ *     arena reset counts as a single op.
+ */
+static void eval_mm_latency(trace_t *trace, lathist_t *lat)
+{
+    static const int kind[] = {
+        [ALLOC] = LAT_MALLOC, [FREE] = LAT_FREE, [REALLOC] = LAT_REALLOC,
+        [ALLOC_BATCH] = LAT_MALLOC, [FREE_BATCH] = LAT_FREE,
+        [ARENA_ALLOC] = LAT_MALLOC, [ARENA_RESET] = LAT_FREE
+    };
+    unsigned long long start;
+    int i, k;
+
+    for (k = 0; k < LAT_KINDS; k++)
+        lh_reset(&lat[k]);
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_init_heaps() < 0)
+        app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        start = lh_rdtscp();
+        replay_op(trace, i);
+        lh_record(&lat[kind[trace->ops[i].type]], lh_rdtscp() - start, i);
+    }
+}
+
+/*
+ * The streaming replay (-R), for traces too large to read in whole.
+ * A loader thread parses the trace into two chunks of STREAM_CHUNK ops
+ * in turn: while one is replayed, the other is filled. Block ids map to
+ * 32-bit heap offsets in a hash table that only holds the live blocks,
+ * so memory does not grow with num_ids. There are no correctness checks;
+ * only the time spent replaying counts, not the time waiting for I/O.
+ */
+typedef struct {
+    traceop_t ops[STREAM_CHUNK];
+    int n;                  /* ops in the chunk, 0 at the end */
+    int full;               /* loaded and not replayed yet */
+} chunk_t;
+
+typedef struct {
+    FILE *file;
+    const char *filename;
+    chunk_t chunk[2];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /* a chunk became full or empty */
+} stream_t;
+
+/* an entry of the id map: id + 1 (0 if empty), heap offset and size */
+typedef struct {
+    unsigned int key;
+    unsigned int off;
+    unsigned int size;
+} idmap_entry_t;
+
+static idmap_entry_t *idmap;
+static unsigned int idmap_mask;   /* table length - 1, a power of 2 */
+static unsigned int idmap_count;  /* live entries */
+
+#define IDMAP_HASH(key) (((key) * 2654435761u) & idmap_mask)
+
+/*
+ * idmap_find - slot of id, or the empty slot where it would go
+ */
+static idmap_entry_t *idmap_find(unsigned int id)
+{
+    unsigned int i;
+
+    for (i = IDMAP_HASH(id + 1); idmap[i].key; i = (i + 1) & idmap_mask)
+        if (idmap[i].key == id + 1)
+            break;
+    return &idmap[i];
+}
+
+/*
+ * idmap_grow - double the table, keeping it at most half full
+ */
+static void idmap_grow(void)
+{
+    idmap_entry_t *old = idmap, *e;
+    unsigned int i, n = idmap_mask + 1;
+
+    idmap_mask = 2 * n - 1;
+    if ((idmap = calloc(2 * n, sizeof(idmap_entry_t))) == NULL)
+        unix_error("calloc failed in idmap_grow");
+    for (i = 0; i < n; i++) {
+        if (old[i].key) {
+            e = idmap_find(old[i].key - 1);
+            *e = old[i];
+        }
+    }
+    free(old);
+}
+
+/*
+ * idmap_erase - empty slot e, moving later entries of its run back
+ */
+static void idmap_erase(idmap_entry_t *e)
+{
+    unsigned int i = e - idmap, j;
+    idmap_entry_t moved;
+
+    e->key = 0;
+    idmap_count--;
+    for (j = (i + 1) & idmap_mask; idmap[j].key; j = (j + 1) & idmap_mask) {
+        moved = idmap[j];
+        idmap[j].key = 0;
+        *idmap_find(moved.key - 1) = moved;
+    }
+}
+
+/*
+ * stream_loader - body of the loader thread: fill the chunks in turn
+ */
+static void *stream_loader(void *ptr)
+{
+    stream_t *st = (stream_t *)ptr;
+    chunk_t *c;
+    char type[MAXLINE];
+    unsigned int index, size = 0;
+    int k, n, r;
+
+    for (k = 0; ; k ^= 1) {
+        c = &st->chunk[k];
+        pthread_mutex_lock(&st->lock);
+        while (c->full)
+            pthread_cond_wait(&st->cond, &st->lock);
+        pthread_mutex_unlock(&st->lock);
+
+        for (n = 0; n < STREAM_CHUNK && fscanf(st->file, "%s", type) != EOF;
+             n++) {
+            switch (type[0]) {
+            case 'a':
+                c->ops[n].type = ALLOC;
+                r = fscanf(st->file, "%u %u", &index, &size);
+                break;
+            case 'r':
+                c->ops[n].type = REALLOC;
+                r = fscanf(st->file, "%u %u", &index, &size);
+                break;
+            case 'f':
+                c->ops[n].type = FREE;
+                r = fscanf(st->file, "%u", &index);
+                break;
+            default:
+                app_error("Request type %c in %s cannot be streamed",
+                          type[0], st->filename);
             }
-            mm_free(block);
+            /* a request without an index is an error; one without a
+               size keeps the last size, as in read_trace */
+            if (r < 1)
+                app_error("Bad request in %s", st->filename);
+            c->ops[n].index = index;
+            c->ops[n].size = size;
+        }
+
+        pthread_mutex_lock(&st->lock);
+        c->n = n;
+        c->full = 1;
+        pthread_cond_broadcast(&st->cond);
+        pthread_mutex_unlock(&st->lock);
+        if (n == 0)
+            return NULL;
+    }
+}
+
+/*
+ * stream_chunk - Replay one chunk of a streamed trace, keeping the live
+ *     payload bytes up to date
+ */
+static void stream_chunk(chunk_t *c, size_t *live, size_t *max_live)
+{
+    char *lo = mem_heap_lo();
+    idmap_entry_t *e;
+    traceop_t *op;
+    char *p;
+    int i;
+
+    for (i = 0; i < c->n; i++) {
+        op = &c->ops[i];
+        switch (op->type) {
+        case ALLOC:
+            if ((p = mm_malloc(op->size)) == NULL)
+                app_error("mm_malloc error in stream_chunk");
+            e = idmap_find(op->index);
+            if (e->key)           /* the trace reused a live id */
+                *live -= e->size;
+            else
+                idmap_count++;
+            e->key = op->index + 1;
+            e->off = p - lo;
+            e->size = op->size;
+            *live += op->size;
+            if (2 * idmap_count > idmap_mask)
+                idmap_grow();
             break;
 
-        default:
-            app_error("Nonexistent request type in eval_mm_speed");
+        case REALLOC:
+            e = idmap_find(op->index);
+            p = mm_realloc(e->key ? lo + e->off : NULL, op->size);
+            if (p == NULL && op->size != 0)
+                app_error("mm_realloc error in stream_chunk");
+            if (e->key)
+                *live -= e->size;
+            if (p == NULL) {      /* a realloc to 0 bytes frees the block */
+                if (e->key)
+                    idmap_erase(e);
+                break;
+            }
+            if (!e->key)
+                idmap_count++;
+            e->key = op->index + 1;
+            e->off = p - lo;
+            e->size = op->size;
+            *live += op->size;
+            if (2 * idmap_count > idmap_mask)
+                idmap_grow();
+            break;
+
+        default: /* FREE */
+            if ((int)op->index < 0)
+                break;
+            e = idmap_find(op->index);
+            if (!e->key)
+                break;
+            mm_free(lo + e->off);
+            *live -= e->size;
+            idmap_erase(e);
+            break;
+        }
+        if (*live > *max_live)
+            *max_live = *live;
+    }
+}
+
+/*
+ * eval_mm_stream - Replay a trace once as it is read in, and record its
+ *     throughput and space utilization
+ */
+static void eval_mm_stream(const char *tracedir, const char *filename,
+                           stats_t *stats)
+{
+    stream_t *st;
+    pthread_t loader;
+    struct timespec t0, t1, t2;
+    double replay = 0, wait = 0;
+    size_t live = 0, max_live = 0;
+    long ops = 0;
+    int k, r, num_ids, num_ops, ignore_ranges;
+
+    strcpy(stats->filename, tracedir);
+    strcat(stats->filename, filename);
+    if (verbose > 1)
+        printf("Streaming tracefile: %s\n", stats->filename);
+
+    if ((st = (stream_t *)calloc(1, sizeof(stream_t))) == NULL)
+        unix_error("calloc failed in eval_mm_stream");
+    st->filename = stats->filename;
+    if ((st->file = fopen(stats->filename, "r")) == NULL)
+        unix_error("Could not open %s in eval_mm_stream", stats->filename);
+    r = fscanf(st->file, "%d %d %d %d", &stats->weight, &num_ids, &num_ops,
+               &ignore_ranges);
+    if (r != 4)
+        app_error("Bad header in %s", stats->filename);
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->cond, NULL);
+
+    idmap_mask = 1023;
+    idmap_count = 0;
+    if ((idmap = calloc(idmap_mask + 1, sizeof(idmap_entry_t))) == NULL)
+        unix_error("calloc failed in eval_mm_stream");
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_stream");
+    if (pthread_create(&loader, NULL, stream_loader, st))
+        unix_error("pthread_create failed in eval_mm_stream");
+
+    for (k = 0; ; k ^= 1) {
+        chunk_t *c = &st->chunk[k];
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        pthread_mutex_lock(&st->lock);
+        while (!c->full)
+            pthread_cond_wait(&st->cond, &st->lock);
+        pthread_mutex_unlock(&st->lock);
+        if (c->n == 0)
+            break;
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        stream_chunk(c, &live, &max_live);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+        ops += c->n;
+        wait += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        replay += (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+
+        pthread_mutex_lock(&st->lock);
+        c->full = 0;
+        pthread_cond_broadcast(&st->cond);
+        pthread_mutex_unlock(&st->lock);
+    }
+    pthread_join(loader, NULL);
+
+    if (verbose > 1)
+        printf("Replayed %ld ops in %.3f secs, %.3f secs waiting for I/O\n",
+               ops, replay, wait);
+
+    stats->valid = 1;
+    stats->ops = ops;
+    stats->secs = replay;
+    stats->util = (double)max_live / mem_heapsize();
+
+    fclose(st->file);
+    pthread_mutex_destroy(&st->lock);
+    pthread_cond_destroy(&st->cond);
+    free(st);
+    free(idmap);
+}
+
+/*
+ * split_ops - Collect the ops of a trace that touch a block of thread
+ *     tid of n, where block k belongs to thread k % n, into ops;
+ *     return how many there are
+ */
+static int split_ops(trace_t *trace, int n, int tid, int *ops)
+{
+    int i, k, count, num = 0;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        count = (trace->ops[i].type == ALLOC_BATCH ||
+                 trace->ops[i].type == FREE_BATCH ||
+                 trace->ops[i].type == ARENA_RESET) ? trace->ops[i].count : 1;
+        for (k = trace->ops[i].index; k < trace->ops[i].index + count; k++)
+            if (k >= 0 && k % n == tid) {
+                ops[num++] = i;
+                break;
+            }
+    }
+    return num;
+}
+
+/*
+ * The multi-threaded replay (-T). The blocks of a trace are dealt out to
+ * the threads, block k to thread k % num_threads, and each thread
+ * replays the ops on its own blocks in trace order on the heap of its
+ * node, so that the threads together replay the trace once. Every
+ * HANDOFF-th free of a thread is left to the next thread, which touches
+ * and frees the block after all threads are done: on more than one node
+ * these are remote accesses and remote frees.
+ */
+typedef struct {
+    trace_t *trace;
+    int tid;
+    int *ops;                     /* the ops on this thread's blocks */
+    int num_ops;
+    char **blocks;                /* shared, but block k is only used by
+                                     thread k % num_threads */
+    char **handoff;               /* blocks left to the next thread */
+    int num_handoff;
+    unsigned long num_frees;
+    int failed;                   /* a malloc or realloc ran out of memory */
+    unsigned long local_access;
+    unsigned long remote_access;
+} thread_arg_t;
+
+static thread_arg_t *thread_args;
+static pthread_barrier_t thread_barrier;
+
+/*
+ * touch_block - Write to a block and count the access as local or remote
+ */
+static void touch_block(thread_arg_t *arg, char *p)
+{
+    *p = 0;
+    if (mm_numa_node_of(p) == mm_numa_this_node())
+        arg->local_access++;
+    else
+        arg->remote_access++;
+}
+
+/*
+ * thread_free - Free a block in the threaded replay, or leave it to the
+ *     next thread
+ */
+static void thread_free(thread_arg_t *arg, int index)
+{
+    if (index < 0 || arg->blocks[index] == NULL)
+        return;
+    if (++arg->num_frees % HANDOFF == 0)
+        arg->handoff[arg->num_handoff++] = arg->blocks[index];
+    else
+        mm_numa_free(arg->blocks[index]);
+    arg->blocks[index] = NULL;
+}
+
+/*
+ * replay_ops - Replay the ops of one thread of the threaded replay
+ *     return 0 if the heap ran out of memory, 1 otherwise
+ */
+static int replay_ops(thread_arg_t *arg)
+{
+    trace_t *trace = arg->trace;
+    int i, j, k, count, index;
+    size_t size;
+    char *p;
+
+    for (j = 0; j < arg->num_ops; j++) {
+        i = arg->ops[j];
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        count = (trace->ops[i].type == ALLOC_BATCH ||
+                 trace->ops[i].type == FREE_BATCH ||
+                 trace->ops[i].type == ARENA_RESET) ? trace->ops[i].count : 1;
+
+        for (k = index; k < index + count; k++) {
+            if (k < 0 || k % num_threads != arg->tid)
+                continue;
+
+            switch (trace->ops[i].type) {
+            case ALLOC:
+            case ALLOC_BATCH:
+            case ARENA_ALLOC:
+                if ((p = mm_numa_malloc(size)) == NULL)
+                    return 0;
+                touch_block(arg, p);
+                arg->blocks[k] = p;
+                break;
+
+            case REALLOC:
+                p = mm_numa_realloc(arg->blocks[k], size);
+                if (p == NULL && size != 0)
+                    return 0;
+                if (p)
+                    touch_block(arg, p);
+                arg->blocks[k] = p;
+                break;
+
+            case FREE:
+            case FREE_BATCH:
+            case ARENA_RESET:
+                thread_free(arg, k);
+                break;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * replay_thread - Body of one thread of the threaded replay
+ */
+static void *replay_thread(void *ptr)
+{
+    thread_arg_t *arg = (thread_arg_t *)ptr;
+    thread_arg_t *next = &thread_args[(arg->tid + 1) % num_threads];
+    int k;
+    char *p;
+
+    mm_numa_set_node(arg->tid % num_nodes);
+    pthread_barrier_wait(&thread_barrier);
+
+    arg->failed = !replay_ops(arg);
+    mm_numa_flush();
+
+    /* Free what the next thread left to us */
+    pthread_barrier_wait(&thread_barrier);
+    for (k = 0; k < next->num_handoff; k++) {
+        p = next->handoff[k];
+        if (p) {
+            touch_block(arg, p);
+            mm_numa_free(p);
         }
+    }
+    mm_numa_flush();
+
+    return NULL;
+}
+
+/*
+ * eval_mm_threads - Replay a trace with num_threads threads on per-node
+ *     heaps, recording the wall time and the local and remote counts,
+ *     or that a heap ran out of memory.
+ */
+static void eval_mm_threads(trace_t *trace, stats_t *stats)
+{
+    pthread_t *tids;
+    struct timespec start, end;
+    char **blocks;
+    int t;
+
+    if ((num_nodes = mm_numa_init(num_nodes)) < 0)
+        app_error("mm_numa_init failed in eval_mm_threads");
+
+    thread_args = (thread_arg_t *)calloc(num_threads, sizeof(thread_arg_t));
+    tids = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+    blocks = (char **)calloc(trace->num_ids, sizeof(char *));
+    if (thread_args == NULL || tids == NULL || blocks == NULL)
+        unix_error("calloc failed in eval_mm_threads");
+
+    for (t = 0; t < num_threads; t++) {
+        thread_args[t].trace = trace;
+        thread_args[t].tid = t;
+        thread_args[t].blocks = blocks;
+        thread_args[t].ops = (int *)malloc(trace->num_ops * sizeof(int));
+        thread_args[t].handoff = (char **)calloc(trace->num_reqs,
+                                                 sizeof(char *));
+        if (!thread_args[t].ops || !thread_args[t].handoff)
+            unix_error("malloc failed in eval_mm_threads");
+        thread_args[t].num_ops = split_ops(trace, num_threads, t,
+                                           thread_args[t].ops);
+    }
+
+    /* Time from the moment all threads are ready until the last ends */
+    pthread_barrier_init(&thread_barrier, NULL, num_threads);
+    for (t = 0; t < num_threads; t++)
+        if (pthread_create(&tids[t], NULL, replay_thread, &thread_args[t]))
+            unix_error("pthread_create failed in eval_mm_threads");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (t = 0; t < num_threads; t++)
+        pthread_join(tids[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_barrier_destroy(&thread_barrier);
+
+    stats->thread_secs = (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+    stats->thread_valid = 1;
+    stats->local_access = stats->remote_access = 0;
+    for (t = 0; t < num_threads; t++) {
+        if (thread_args[t].failed)
+            stats->thread_valid = 0;
+        stats->local_access += thread_args[t].local_access;
+        stats->remote_access += thread_args[t].remote_access;
+        free(thread_args[t].ops);
+        free(thread_args[t].handoff);
+    }
+    mm_numa_stats(&stats->numa);
+
+    free(blocks);
+    free(thread_args);
+    free(tids);
+    mm_numa_deinit();
+}
+
+/*
+ * The false sharing benchmark (-F). The objects of fs_threads threads
+ * are allocated from one heap in turn, as threads running side by side
+ * would get them, and then every thread keeps writing to its own
+ * objects only. Packed objects of different threads share cache lines,
+ * which then bounce between the cores; in cache line mode none do.
+ */
+typedef struct {
+    int tid;
+    char **objs;                  /* FS_OBJS objects of this thread */
+} fs_arg_t;
+
+/*
+ * fs_thread - Body of one thread of the false sharing benchmark
+ */
+static void *fs_thread(void *ptr)
+{
+    fs_arg_t *arg = (fs_arg_t *)ptr;
+    int r, k;
+
+    pthread_barrier_wait(&thread_barrier);
+    for (r = 0; r < FS_ROUNDS; r++)
+        for (k = 0; k < FS_OBJS; k++)
+            (*(volatile long *)arg->objs[k])++;
+    return NULL;
+}
+
+/*
+ * fs_line_cmp - qsort comparator ordering line/thread pairs
+ */
+static int fs_line_cmp(const void *p, const void *q)
+{
+    const unsigned long *a = (const unsigned long *)p;
+    const unsigned long *b = (const unsigned long *)q;
+    if (a[0] != b[0])
+        return (a[0] > b[0]) - (a[0] < b[0]);
+    return (a[1] > b[1]) - (a[1] < b[1]);
+}
+
+/*
+ * fs_shared_lines - Count the cache lines holding objects of more than
+ *     one thread; object i belongs to thread i % fs_threads
+ */
+static int fs_shared_lines(char **objs, int n)
+{
+    unsigned long (*pairs)[2], lo, hi;
+    int i, m = 0, shared = 0;
+
+    if ((pairs = malloc(2 * n * sizeof(*pairs))) == NULL)
+        unix_error("malloc failed in fs_shared_lines");
+    for (i = 0; i < n; i++) {
+        lo = (unsigned long)objs[i] / FS_LINE;
+        hi = ((unsigned long)objs[i] + FS_SIZE - 1) / FS_LINE;
+        pairs[m][0] = lo;
+        pairs[m++][1] = i % fs_threads;
+        if (hi != lo) {
+            pairs[m][0] = hi;
+            pairs[m++][1] = i % fs_threads;
+        }
+    }
+    qsort(pairs, m, sizeof(*pairs), fs_line_cmp);
+
+    /* a line is shared if its first and last pairs differ in thread */
+    for (i = 0; i < m; ) {
+        int j = i;
+        while (j + 1 < m && pairs[j + 1][0] == pairs[i][0])
+            j++;
+        if (pairs[j][1] != pairs[i][1])
+            shared++;
+        i = j + 1;
+    }
+    free(pairs);
+    return shared;
+}
+
+/*
+ * eval_false_sharing - Run the false sharing benchmark with the objects
+ *     packed and then in cache line mode, and print the results
+ */
+static void eval_false_sharing(void)
+{
+    static const char *names[2] = {"packed", "line"};
+    int n = fs_threads * FS_OBJS;
+    fs_arg_t *args;
+    pthread_t *tids;
+    mm_heap_t *h;
+    char **objs;
+    struct timespec start, end;
+    double secs;
+    int mode, t, i;
+
+    args = (fs_arg_t *)calloc(fs_threads, sizeof(fs_arg_t));
+    tids = (pthread_t *)calloc(fs_threads, sizeof(pthread_t));
+    objs = (char **)calloc(n, sizeof(char *));
+    if (args == NULL || tids == NULL || objs == NULL)
+        unix_error("calloc failed in eval_false_sharing");
+
+    printf("False sharing with %d threads, each writing %d objects "
+           "of %d bytes %d times:\n", fs_threads, FS_OBJS, FS_SIZE, FS_ROUNDS);
+    printf("%10s%14s%10s%12s%10s\n", "placement", "shared lines", "secs",
+           "Mwrites/s", "heap KB");
+
+    for (mode = 0; mode < 2; mode++) {
+        mm_set_cacheline(mode);
+        if ((h = mm_heap_create()) == NULL)
+            app_error("mm_heap_create failed in eval_false_sharing");
+
+        /* object k of thread t is the (k * fs_threads + t)-th allocated */
+        for (i = 0; i < n; i++)
+            if ((objs[i] = mm_heap_malloc(h, FS_SIZE)) == NULL)
+                app_error("mm_heap_malloc failed in eval_false_sharing");
+        for (t = 0; t < fs_threads; t++) {
+            args[t].tid = t;
+            args[t].objs = (char **)malloc(FS_OBJS * sizeof(char *));
+            if (args[t].objs == NULL)
+                unix_error("malloc failed in eval_false_sharing");
+            for (i = 0; i < FS_OBJS; i++)
+                args[t].objs[i] = objs[i * fs_threads + t];
+        }
+
+        /* start the clock as the threads are released together */
+        pthread_barrier_init(&thread_barrier, NULL, fs_threads + 1);
+        for (t = 0; t < fs_threads; t++)
+            if (pthread_create(&tids[t], NULL, fs_thread, &args[t]))
+                unix_error("pthread_create failed in eval_false_sharing");
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_barrier_wait(&thread_barrier);
+        for (t = 0; t < fs_threads; t++)
+            pthread_join(tids[t], NULL);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        pthread_barrier_destroy(&thread_barrier);
+
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%10s%14d%10.4f%12.1f%10.0f\n", names[mode],
+               fs_shared_lines(objs, n), secs,
+               (double)n * FS_ROUNDS / 1e6 / secs,
+               ((char *)mem_region_hi(mm_heap_region(h)) -
+                (char *)mem_region_lo(mm_heap_region(h)) + 1) / 1024.0);
+
+        for (t = 0; t < fs_threads; t++)
+            free(args[t].objs);
+        mm_heap_destroy(h);
+    }
+
+    free(args);
+    free(tids);
+    free(objs);
+}
+
+/*
+ * The scaling replay (-X). The blocks of a trace are dealt out to the
+ * threads, block i to thread i % n, and each thread replays the ops on
+ * its own blocks in trace order, from a list of them made beforehand, all of them on the default heap in
+ * concurrent mode. The work is the same for any n, so the throughput
+ * shows how the heap scales with the number of threads.
+ */
+typedef struct {
+    trace_t *trace;
+    int tid;
+    int n;                        /* number of threads */
+    int *ops;                     /* the ops on this thread's blocks */
+    int num_ops;
+    char **blocks;                /* shared, but block i is only used by
+                                     thread i % n */
+} scale_arg_t;
+
+/*
+ * scale_thread - Body of one thread of the scaling replay
+ */
+static void *scale_thread(void *ptr)
+{
+    scale_arg_t *arg = (scale_arg_t *)ptr;
+    trace_t *trace = arg->trace;
+    int i, j, k, count;
+    size_t size;
+    char *p;
+
+    pthread_barrier_wait(&thread_barrier);
+    for (j = 0; j < arg->num_ops; j++) {
+        i = arg->ops[j];
+        size = trace->ops[i].size;
+        count = (trace->ops[i].type == ALLOC_BATCH ||
+                 trace->ops[i].type == FREE_BATCH ||
+                 trace->ops[i].type == ARENA_RESET) ? trace->ops[i].count : 1;
+
+        for (k = trace->ops[i].index; k < trace->ops[i].index + count; k++) {
+            if (k < 0 || k % arg->n != arg->tid)
+                continue;
+
+            switch (trace->ops[i].type) {
+            case ALLOC:
+            case ALLOC_BATCH:
+            case ARENA_ALLOC:
+                if ((p = mm_malloc(size)) == NULL)
+                    app_error("mm_malloc error in scale_thread");
+                *p = 0;
+                arg->blocks[k] = p;
+                break;
+
+            case REALLOC:
+                p = mm_realloc(arg->blocks[k], size);
+                if (p == NULL && size != 0)
+                    app_error("mm_realloc error in scale_thread");
+                arg->blocks[k] = p;
+                break;
+
+            case FREE:
+            case FREE_BATCH:
+            case ARENA_RESET:
+                mm_free(arg->blocks[k]);
+                arg->blocks[k] = NULL;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * eval_scaling - Replay every trace on a concurrent heap with 1, 2, 4,
+ *     ... SCALE_THREADS threads, check the heap after each replay, and
+ *     print the throughput over all traces for each number of threads
+ */
+static void eval_scaling(int num_tracefiles, char **tracefiles)
+{
+    scale_arg_t args[SCALE_THREADS];
+    pthread_t tids[SCALE_THREADS];
+    struct timespec start, end;
+    double ops, secs, base = 0;
+    stats_t stats;
+    trace_t *trace;
+    char **blocks;
+    int n, i, t;
+
+    mm_set_concurrent(1);
+    printf("Replay of %d traces on a concurrent heap:\n", num_tracefiles);
+    printf("%10s%12s%10s%10s%10s\n", "threads", "ops", "secs", "Kops",
+           "speedup");
+
+    for (n = 1; n <= SCALE_THREADS; n *= 2) {
+        ops = secs = 0;
+        for (i = 0; i < num_tracefiles; i++) {
+            trace = read_trace(&stats, tracedir, tracefiles[i]);
+            blocks = (char **)calloc(trace->num_ids, sizeof(char *));
+            if (blocks == NULL)
+                unix_error("calloc failed in eval_scaling");
+            for (t = 0; t < n; t++) {
+                args[t].ops = (int *)malloc(trace->num_ops * sizeof(int));
+                if (args[t].ops == NULL)
+                    unix_error("malloc failed in eval_scaling");
+                args[t].num_ops = split_ops(trace, n, t, args[t].ops);
+            }
+
+            mem_init();
+            if (mm_init() < 0)
+                app_error("mm_init failed in eval_scaling");
+
+            /* start the clock as the threads are released together */
+            pthread_barrier_init(&thread_barrier, NULL, n + 1);
+            for (t = 0; t < n; t++) {
+                args[t].trace = trace;
+                args[t].tid = t;
+                args[t].n = n;
+                args[t].blocks = blocks;
+                if (pthread_create(&tids[t], NULL, scale_thread, &args[t]))
+                    unix_error("pthread_create failed in eval_scaling");
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            pthread_barrier_wait(&thread_barrier);
+            for (t = 0; t < n; t++)
+                pthread_join(tids[t], NULL);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            pthread_barrier_destroy(&thread_barrier);
+
+            mm_checkheap(__LINE__);
+            ops += trace->num_ops;
+            secs += (end.tv_sec - start.tv_sec) +
+                (end.tv_nsec - start.tv_nsec) / 1e9;
+            for (t = 0; t < n; t++)
+                free(args[t].ops);
+            free(blocks);
+            free_trace(trace);
+            mem_deinit();
+        }
+
+        if (n == 1)
+            base = ops / secs;
+        printf("%10d%12.0f%10.4f%10.0f%10.2f\n", n, ops, secs,
+               ops / 1e3 / secs, ops / secs / base);
+    }
+    mm_set_concurrent(0);
+}
+
+/*
+ * The producer/consumer benchmark (-Q). One thread allocates PC_OBJS
+ * objects of 16 to 256 bytes from a heap of its own and deals them out
+ * to pc_threads consumers, over a ring per consumer; the consumers touch
+ * and free them. The frees go back to the producer's heap in one of
+ * three ways: under a lock that the producer's mallocs take as well,
+ * straight into a heap in concurrent mode, or onto the heap's remote
+ * free queue, which the producer drains as it mallocs.
+ */
+#define PC_LOCKED     0
+#define PC_CONCURRENT 1
+#define PC_REMOTE     2
+
+typedef struct {
+    char *slot[PC_RING];
+    unsigned long head;           /* slots filled, by the producer */
+    unsigned long tail;           /* slots emptied, by the consumer */
+} pc_ring_t;
+
+static mm_heap_t *pc_heap;
+static pthread_mutex_t pc_lock = PTHREAD_MUTEX_INITIALIZER;
+static int pc_mode;
+
+/*
+ * pc_put - Hand an object over to a consumer, NULL to stop it
+ */
+static void pc_put(pc_ring_t *ring, char *p)
+{
+    unsigned long head = ring->head;
+
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == PC_RING)
+        sched_yield();
+    ring->slot[head % PC_RING] = p;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * pc_consumer - Body of one consumer of the producer/consumer benchmark
+ */
+static void *pc_consumer(void *ptr)
+{
+    pc_ring_t *ring = (pc_ring_t *)ptr;
+    unsigned long tail;
+    char *p;
+
+    pthread_barrier_wait(&thread_barrier);
+    for (tail = 0; ; tail++) {
+        while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+            sched_yield();
+        p = ring->slot[tail % PC_RING];
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        if (p == NULL)
+            break;
+
+        (*p)++;
+        switch (pc_mode) {
+        case PC_LOCKED:
+            pthread_mutex_lock(&pc_lock);
+            mm_heap_free(pc_heap, p);
+            pthread_mutex_unlock(&pc_lock);
+            break;
+        case PC_CONCURRENT:
+            mm_heap_free(pc_heap, p);
+            break;
+        case PC_REMOTE:
+            mm_heap_free_remote(pc_heap, p);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * eval_producer_consumer - Run the producer/consumer benchmark with each
+ *     way of freeing, and print the throughput and the heap size
+ */
+static void eval_producer_consumer(void)
+{
+    static const char *names[] = {"locked", "concurrent", "remote"};
+    pc_ring_t *rings;
+    pthread_t *tids;
+    struct timespec start, end;
+    double secs;
+    size_t size;
+    char *p;
+    int t, i;
+
+    rings = (pc_ring_t *)calloc(pc_threads, sizeof(pc_ring_t));
+    tids = (pthread_t *)calloc(pc_threads, sizeof(pthread_t));
+    if (rings == NULL || tids == NULL)
+        unix_error("calloc failed in eval_producer_consumer");
+
+    printf("Producer/consumer with 1 producer and %d consumers, "
+           "%d objects of 16 to 256 bytes:\n", pc_threads, PC_OBJS);
+    printf("%10s%10s%10s%10s\n", "frees", "secs", "Mobjs/s", "heap KB");
+
+    for (pc_mode = PC_LOCKED; pc_mode <= PC_REMOTE; pc_mode++) {
+        mm_set_concurrent(pc_mode == PC_CONCURRENT);
+        pc_heap = mm_heap_create();
+        mm_set_concurrent(0);
+        if (pc_heap == NULL)
+            app_error("mm_heap_create failed in eval_producer_consumer");
+        memset(rings, 0, pc_threads * sizeof(pc_ring_t));
+
+        /* start the clock as the consumers are released */
+        pthread_barrier_init(&thread_barrier, NULL, pc_threads + 1);
+        for (t = 0; t < pc_threads; t++)
+            if (pthread_create(&tids[t], NULL, pc_consumer, &rings[t]))
+                unix_error("pthread_create failed in eval_producer_consumer");
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_barrier_wait(&thread_barrier);
+
+        for (i = 0; i < PC_OBJS; i++) {
+            size = 16 + (size_t)i * 7919 % 241;
+            if (pc_mode == PC_LOCKED)
+                pthread_mutex_lock(&pc_lock);
+            p = mm_heap_malloc(pc_heap, size);
+            if (pc_mode == PC_LOCKED)
+                pthread_mutex_unlock(&pc_lock);
+            if (p == NULL)
+                app_error("mm_heap_malloc failed in eval_producer_consumer");
+            *p = 0;
+            pc_put(&rings[i % pc_threads], p);
+        }
+        for (t = 0; t < pc_threads; t++)
+            pc_put(&rings[t], NULL);
+
+        for (t = 0; t < pc_threads; t++)
+            pthread_join(tids[t], NULL);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        pthread_barrier_destroy(&thread_barrier);
+
+        mm_heap_checkheap(pc_heap, __LINE__);
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%10s%10.4f%10.2f%10.0f\n", names[pc_mode], secs,
+               PC_OBJS / 1e6 / secs,
+               ((char *)mem_region_hi(mm_heap_region(pc_heap)) -
+                (char *)mem_region_lo(mm_heap_region(pc_heap)) + 1) / 1024.0);
+        mm_heap_destroy(pc_heap);
+    }
+
+    free(rings);
+    free(tids);
 }
 
 /*
@@ -1164,7 +2864,7 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace)
 {
-    int i, newsize;
+    int i, k, newsize;
     char *p, *newp, *oldp;
 
     reinit_trace(trace);
@@ -1198,6 +2898,30 @@ static int eval_libc_valid(trace_t *trace)
             }
             break;
 
+        case ALLOC_BATCH: /* malloc, once per block */
+            for (k = 0; k < trace->ops[i].count; k++) {
+                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                    malloc_error(trace, i, "libc malloc failed");
+                    unix_error("System message");
+                }
+                trace->blocks[trace->ops[i].index + k] = p;
+            }
+            break;
+
+        case FREE_BATCH: /* free, once per block */
+        case ARENA_RESET:
+            for (k = 0; k < trace->ops[i].count; k++)
+                free(trace->blocks[trace->ops[i].index + k]);
+            break;
+
+        case ARENA_ALLOC: /* malloc */
+            if ((p = malloc(trace->ops[i].size)) == NULL) {
+                malloc_error(trace, i, "libc malloc failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = p;
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1213,7 +2937,7 @@ static int eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, k;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -1249,6 +2973,31 @@ static void eval_libc_speed(void *ptr)
                 free(0);
             }
             break;
+
+        case ALLOC_BATCH: /* malloc, once per block */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            for (k = 0; k < trace->ops[i].count; k++) {
+                if ((p = malloc(size)) == NULL)
+                    unix_error("malloc failed in eval_libc_speed");
+                trace->blocks[index + k] = p;
+            }
+            break;
+
+        case FREE_BATCH: /* free, once per block */
+        case ARENA_RESET:
+            index = trace->ops[i].index;
+            for (k = 0; k < trace->ops[i].count; k++)
+                free(trace->blocks[index + k]);
+            break;
+
+        case ARENA_ALLOC: /* malloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = malloc(size)) == NULL)
+                unix_error("malloc failed in eval_libc_speed");
+            trace->blocks[index] = p;
+            break;
         }
     }
 }
@@ -1276,8 +3025,11 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     char wstr;
 
     /* Print the individual results for each trace */
-    printf("  %2s%6s %5s%8s%9s  %s\n",
-           "valid", "util", "ops", "secs", "Kops", "trace");
+    printf("  %2s%6s %5s%8s%9s",
+           "valid", "util", "ops", "secs", "Kops");
+    if (count_events)
+        printf("%6s%9s%9s%9s", "IPC", "cache/op", "br/op", "dTLB/op");
+    printf("  %s\n", "trace");
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
             switch(stats[i].weight)
@@ -1319,6 +3071,9 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
             else
                 printf("%8s%10s%6s", "--", "--", "--");
 
+            if (count_events)
+                printcounts(&stats[i]);
+
             printf(" %s\n", stats[i].filename);
 
             if(stats[i].weight == WALL || stats[i].weight == WPERF)
@@ -1384,6 +3139,121 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
 }
 
+/*
+ * printthreadresults - prints throughput and the local/remote access and
+ *                      free counts of the multi-threaded replay
+ */
+static void printthreadresults(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%10s%8s%11s%11s%10s%10s%8s  %s\n", "ops", "Kops",
+           "local acc", "remote acc", "local fr", "remote fr", "flushes",
+           "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        if (!stats[i].thread_valid) {
+            printf("%10.0f%8s%50s  %s\n", stats[i].ops, "-",
+                   "out of memory", stats[i].filename);
+            continue;
+        }
+        printf("%10.0f%8.0f%11lu%11lu%10lu%10lu%8lu  %s\n",
+               stats[i].ops,
+               (stats[i].ops / 1e3) / stats[i].thread_secs,
+               stats[i].local_access, stats[i].remote_access,
+               stats[i].numa.local_frees, stats[i].numa.remote_frees,
+               stats[i].numa.remote_flushes, stats[i].filename);
+    }
+}
+
+/*
+ * printcounts - prints IPC and the misses per op of one trace's speed run
+ */
+static void printcounts(stats_t *stats)
+{
+    long long *c = stats->counts;
+    int e;
+
+    if (c[PC_CYCLES] > 0 && c[PC_INSTRUCTIONS] >= 0)
+        printf("%6.2f", (double)c[PC_INSTRUCTIONS] / c[PC_CYCLES]);
+    else
+        printf("%6s", "n/a");
+
+    for (e = PC_CACHE_MISS; e <= PC_DTLB_MISS; e++) {
+        if (c[e] >= 0)
+            printf("%9.3f", c[e] / stats->ops);
+        else
+            printf("%9s", "n/a");
+    }
+}
+
+/*
+ * printlatresults - prints the latency percentiles of each kind of op
+ *                   and the trace lines of the slowest ones
+ */
+static void printlatresults(int n, stats_t *stats)
+{
+    static const char *names[LAT_KINDS] = {"malloc", "free", "realloc"};
+    static const double pcts[] = {0.5, 0.9, 0.99, 0.999};
+    lathist_t *h;
+    int i, k, p, w;
+
+    printf("%9s%8s%8s%8s%8s%8s%10s  %s\n", "", "ops", "p50", "p90", "p99",
+           "p999", "max", "slowest lines");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("%s\n", stats[i].filename);
+        for (k = 0; k < LAT_KINDS; k++) {
+            h = &stats[i].lat[k];
+            if (h->total == 0)
+                continue;
+            printf("%9s%8llu", names[k], h->total);
+            for (p = 0; p < 4; p++)
+                printf("%8llu", lh_percentile(h, pcts[p]));
+            printf("%10llu ", h->max);
+            for (w = 0; w < LH_WORST && h->worst[w]; w++)
+                printf(" %d", LINENUM(h->worst_tag[w]));
+            printf("\n");
+
+            /* the same ops on the ordered lists, to compare TLSF with */
+            if (stats[i].lat_base == NULL)
+                continue;
+            h = &stats[i].lat_base[k];
+            printf("%9s%8s", "seglist", "");
+            for (p = 0; p < 4; p++)
+                printf("%8llu", lh_percentile(h, pcts[p]));
+            printf("%10llu ", h->max);
+            for (w = 0; w < LH_WORST && h->worst[w]; w++)
+                printf(" %d", LINENUM(h->worst_tag[w]));
+            printf("\n");
+        }
+    }
+}
+
+/*
+ * printwalkresults - prints how many links the searches and the ordered
+ *                    inserts of each trace followed on average
+ */
+static void printwalkresults(int n, stats_t *stats)
+{
+    mm_list_stats_t *w;
+    int i;
+
+    printf("%10s%10s%10s%10s  %s\n", "searches", "avg walk", "inserts",
+           "avg walk", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        w = &stats[i].walks;
+        printf("%10lu%10.2f%10lu%10.2f  %s\n", w->fits,
+               w->fits ? (double)w->fit_steps / w->fits : 0.0, w->inserts,
+               w->inserts ? (double)w->insert_steps / w->inserts : 0.0,
+               stats[i].filename);
+    }
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1429,7 +3299,7 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hlVdD] [-f <file>]\n");
+    fprintf(stderr, "Usage: mdriver [-hlVdDbSaPMLRCEBWOGX] [-m <n>] [-F <n>] [-Q <n>] [-H <n>] [-T <n>] [-N <n>] [-f <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-p         Calculate Checkpoint Score.\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
@@ -1442,4 +3312,24 @@ static void usage(void)
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-b         Split batch requests into single calls.\n");
+    fprintf(stderr, "\t-S         Free with mm_free_sized.\n");
+    fprintf(stderr, "\t-a         Split arena requests into single calls.\n");
+    fprintf(stderr, "\t-H <n>     Spread each trace over n independent heaps.\n");
+    fprintf(stderr, "\t-T <n>     Also replay with n threads on per-node heaps.\n");
+    fprintf(stderr, "\t-N <n>     Simulate n NUMA nodes for -T.\n");
+    fprintf(stderr, "\t-P         Back the heaps with transparent huge pages.\n");
+    fprintf(stderr, "\t-M         Count IPC and cache, branch and dTLB misses.\n");
+    fprintf(stderr, "\t-L         Report the latency of each op as percentiles.\n");
+    fprintf(stderr, "\t-R         Replay each trace once while streaming it in (no checks).\n");
+    fprintf(stderr, "\t-m <n>     Snapshot the heap every n ops into <trace>.hmap.\n");
+    fprintf(stderr, "\t-C         Give every small block a cache line of its own.\n");
+    fprintf(stderr, "\t-E         Run the heaps on TLSF lists (with -L, compare latency).\n");
+    fprintf(stderr, "\t-B         Serve blocks of 4 KB to 1 MB near a power of two from buddy arenas.\n");
+    fprintf(stderr, "\t-O         Place small and large blocks at opposite ends of free blocks.\n");
+    fprintf(stderr, "\t-G         Keep block starts and alloc bits in a side table.\n");
+    fprintf(stderr, "\t-W         Report the average walks along the free lists.\n");
+    fprintf(stderr, "\t-F <n>     Run the false sharing benchmark with n threads instead.\n");
+    fprintf(stderr, "\t-Q <n>     Run the producer/consumer benchmark with n consumers instead.\n");
+    fprintf(stderr, "\t-X         Replay the traces on a concurrent heap with 1 to %d threads instead.\n", SCALE_THREADS);
 }
@@ -12,42 +12,91 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* a contiguous region of simulated memory with its own brk pointer */
+struct mem_region {
+	char *heap;						/* first byte of the region */
+	char *mem_brk;					/* current brk pointer */
+	char *mem_max_addr;				/* end of the region */
+	size_t hugepage;				/* huge page size if THP-backed, else 0 */
+};
+
+#define HUGEPAGE (1 << 21)			/* size of a transparent huge page */
+
 /* private variables */
-static char *heap;
-static char *mem_brk;
-static char *mem_max_addr;
+static mem_region_t mem_default;	/* the region managed by mem_init */
+static int use_hugepages = 0;		/* back new regions with huge pages */
+
+/*
+ * map_huge - map len bytes of anonymous memory aligned to a huge page,
+ *		and ask the kernel to back it with transparent huge pages.
+ *		returns MAP_FAILED on error.
+ */
+static char *map_huge(void *start, size_t len){
+	char *p, *aligned;
+
+	p = mmap(start, len + HUGEPAGE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		return p;
+
+	/* trim the unaligned head and the tail */
+	aligned = (char *)(((size_t)p + HUGEPAGE - 1) & ~(size_t)(HUGEPAGE - 1));
+	if (aligned > p)
+		munmap(p, aligned - p);
+	munmap(aligned + len, p + HUGEPAGE - aligned);
+
+	madvise(aligned, len, MADV_HUGEPAGE);
+	return aligned;
+}
+
+/*
+ * mem_set_hugepages - back the regions made from now on by mem_init and
+ *		mem_region_create with transparent huge pages (on != 0), or with
+ *		regular pages (on == 0)
+ */
+void mem_set_hugepages(int on){
+	use_hugepages = on;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void){
-	int dev_zero = open("/dev/zero", O_RDWR);
-	heap = mmap((void *)0x800000000, /* suggested start*/
-			MAX_HEAP,				/* length */
-			PROT_WRITE,				/* permissions */
-			MAP_PRIVATE,			/* private or shared? */
-			dev_zero,				/* fd */
-			0);						/* offset (dunno) */
-	mem_max_addr = heap + MAX_HEAP;
-	mem_brk = heap;					/* heap is empty initially */
+	if (use_hugepages) {
+		mem_default.heap = map_huge((void *)0x800000000, MAX_HEAP);
+		mem_default.hugepage = HUGEPAGE;
+	} else {
+		int dev_zero = open("/dev/zero", O_RDWR);
+		mem_default.heap = mmap((void *)0x800000000, /* suggested start*/
+				MAX_HEAP,				/* length */
+				PROT_WRITE,				/* permissions */
+				MAP_PRIVATE,			/* private or shared? */
+				dev_zero,				/* fd */
+				0);						/* offset (dunno) */
+		close(dev_zero);
+		mem_default.hugepage = 0;
+	}
+	mem_default.mem_max_addr = mem_default.heap + MAX_HEAP;
+	mem_default.mem_brk = mem_default.heap;	/* heap is empty initially */
 }
 
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
-	munmap(heap, MAX_HEAP);
+	munmap(mem_default.heap, MAX_HEAP);
 }
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
 void mem_reset_brk(){
-	mem_brk = heap;
+	mem_region_reset_brk(&mem_default);
 }
 
 /* 
@@ -56,39 +105,28 @@ void mem_reset_brk(){
  *		this model, the heap cannot be shrunk.
  */
 void *mem_sbrk(int incr) {
-	char *old_brk = mem_brk;
-
-    // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
-            sbrk(incr) == (void *) -1) {
-		errno = ENOMEM;
-		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-		return (void *)-1;
-	}
-
-	mem_brk += incr;
-	return (void *)old_brk;
+	return mem_region_sbrk(&mem_default, incr);
 }
 
 /*
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo(){
-	return (void *)heap;
+	return mem_region_lo(&mem_default);
 }
 
 /* 
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi(){
-	return (void *)(mem_brk - 1);
+	return mem_region_hi(&mem_default);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
 size_t mem_heapsize() {
-	return (size_t)((void *)mem_brk - (void *)heap);
+	return mem_region_size(&mem_default);
 }
 
 /*
@@ -97,3 +135,124 @@ size_t mem_heapsize() {
 size_t mem_pagesize(){
 	return (size_t)getpagesize();
 }
+
+/*
+ * mem_default_region - return the region managed by mem_init
+ */
+mem_region_t *mem_default_region(void){
+	return &mem_default;
+}
+
+/*
+ * mem_region_create - map a further region of MAX_HEAP bytes, independent
+ *		of the one managed by mem_init. returns NULL on error.
+ */
+mem_region_t *mem_region_create(void){
+	mem_region_t *r = malloc(sizeof(mem_region_t));
+	if (r == NULL)
+		return NULL;
+
+	if (use_hugepages)
+		r->heap = map_huge(NULL, MAX_HEAP);
+	else
+		r->heap = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (r->heap == MAP_FAILED) {
+		free(r);
+		return NULL;
+	}
+	r->mem_max_addr = r->heap + MAX_HEAP;
+	r->mem_brk = r->heap;
+	r->hugepage = use_hugepages ? HUGEPAGE : 0;
+	return r;
+}
+
+/*
+ * mem_region_destroy - unmap a region made by mem_region_create
+ */
+void mem_region_destroy(mem_region_t *r){
+	munmap(r->heap, r->mem_max_addr - r->heap);
+	free(r);
+}
+
+/*
+ * mem_region_reset_brk - reset the brk pointer of a region to make it empty
+ */
+void mem_region_reset_brk(mem_region_t *r){
+	r->mem_brk = r->heap;
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk for a region. Only the default region
+ *		mirrors the request with a real sbrk().
+ */
+void *mem_region_sbrk(mem_region_t *r, int incr) {
+	char *old_brk = r->mem_brk;
+
+    // call sbrk() in an attempt to have similar semantics as a real allocator.
+	if ( (incr < 0) || ((r->mem_brk + incr) > r->mem_max_addr) ||
+            (r == &mem_default && sbrk(incr) == (void *) -1)) {
+		errno = ENOMEM;
+		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+		return (void *)-1;
+	}
+
+	r->mem_brk += incr;
+	return (void *)old_brk;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of a region
+ */
+void *mem_region_lo(mem_region_t *r){
+	return (void *)r->heap;
+}
+
+/*
+ * mem_region_hi - return address of the last byte in use in a region
+ */
+void *mem_region_hi(mem_region_t *r){
+	return (void *)(r->mem_brk - 1);
+}
+
+/*
+ * mem_region_size - returns the number of bytes in use in a region
+ */
+size_t mem_region_size(mem_region_t *r){
+	return (size_t)((void *)r->mem_brk - (void *)r->heap);
+}
+
+/*
+ * mem_region_bind - place the pages of a region on NUMA node node,
+ *		moving those already touched. returns -1 on error, 0 on success.
+ */
+int mem_region_bind(mem_region_t *r, int node){
+	unsigned long nodemask = 1UL << node;
+	const int mpol_bind = 2;				/* MPOL_BIND */
+	const unsigned int mpol_mf_move = 2;	/* MPOL_MF_MOVE */
+
+	return syscall(SYS_mbind, r->heap, r->mem_max_addr - r->heap, mpol_bind,
+			&nodemask, sizeof(nodemask) * 8, mpol_mf_move) ? -1 : 0;
+}
+
+/*
+ * mem_region_hugepage - returns the huge page size backing a region,
+ *		or 0 if it has regular pages
+ */
+size_t mem_region_hugepage(mem_region_t *r){
+	return r->hugepage;
+}
+
+/*
+ * mem_region_trim - give the whole huge pages within [lo, hi) of a
+ *		THP-backed region back to the kernel. They read as zeros when
+ *		touched again. Does nothing for a region with regular pages.
+ */
+void mem_region_trim(mem_region_t *r, void *lo, void *hi){
+	size_t mask = r->hugepage - 1;
+	char *start = (char *)(((size_t)lo + mask) & ~mask);
+	char *end = (char *)((size_t)hi & ~mask);
+
+	if (r->hugepage && start < end)
+		madvise(start, end - start, MADV_DONTNEED);
+}
@@ -8,4 +8,19 @@ void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+void mem_set_hugepages(int on);
 
+/* independent regions, each with its own brk pointer */
+typedef struct mem_region mem_region_t;
+mem_region_t *mem_default_region(void);
+mem_region_t *mem_region_create(void);
+void mem_region_destroy(mem_region_t *r);
+void mem_region_reset_brk(mem_region_t *r);
+void *mem_region_sbrk(mem_region_t *r, int incr);
+void *mem_region_lo(mem_region_t *r);
+void *mem_region_hi(mem_region_t *r);
+size_t mem_region_size(mem_region_t *r);
+int mem_region_bind(mem_region_t *r, int node);
+
+size_t mem_region_hugepage(mem_region_t *r);
+void mem_region_trim(mem_region_t *r, void *lo, void *hi);
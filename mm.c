@@ -9,25 +9,67 @@
  *
  * This is a dynamic memory allocator.
  * Free block organization: segregated ordered free lists
- *                          each is an explicit free list without footers
- * Placement policy:        first fit in ordered lists, equivalent to best fit
+ *                          each is an explicit free list without footers;
+ *                          or, in TLSF mode, two-level segregated fit:
+ *                          unordered lists found through two bitmaps
+ * Placement policy:        first fit in ordered lists, equivalent to best fit;
+ *                          in TLSF mode, the head of the first list whose
+ *                          blocks all fit, in constant time;
+ *                          in split placement mode, blocks of 256 bytes
+ *                          and up are carved from the high end
+ *                          the wilderness, the free block at the end of
+ *                          the heap, is only used if nothing else fits
  * Coalecsing policy:       immediate coalecsing
+ * Heap extension policy:   adaptive chunk size, or only the shortfall
+ *                          if the last block is free; up to a huge page
+ *                          boundary on THP-backed regions
+ * Cache line mode:         optionally, every small block gets a cache line
+ *                          of its own, so that objects used by different
+ *                          threads never share one
+ * Buddy mode:              optionally, blocks of 4 KB to 1 MB just under
+ *                          a power of two come from binary buddy arenas
+ *                          carved out of the heap
+ * Side table mode:         optionally, where blocks start and which are
+ *                          allocated is also kept in bitmaps outside the
+ *                          heap, which heap walks, neighbour checks and
+ *                          free validation read instead of the blocks
+ * Concurrent mode:         optionally, the heap is shared by threads, with
+ *                          a lock per class list and one for heap growth
+ * Remote frees:            blocks freed by threads other than the owner
+ *                          are queued without a lock and given back at
+ *                          the owner's next malloc
  *
  *
  *
  *
  *
  * The layout of the heap:
- * --------------------------------------------------------------------------
- * | head1 | head2 | ... | headk | (padding) | prologue | blocks | epilogue |
- * --------------------------------------------------------------------------
- * |                                               |             |         |
- * mem_heap_lo()                          heap_listp      epilogue mem_heap_hi()
- * class_head
+ * ----------------------------------------------------
+ * | padding | prologue | blocks | epilogue |
+ * ----------------------------------------------------
+ * |                    |         |         |
+ * mem_heap_lo()   heap_listp  epilogue  mem_heap_hi()
  *
- * k is the number of size classes, CLASS_NUM.
- * The ith class links blocks with size between pow(2, i+3) to pow(2, i+4)
- * Each header is a 4-byte offset relative to heap_listp.
+ * This is the default heap, behind malloc/free/realloc/calloc. A heap
+ * made by mm_heap_create has the same layout in a region of its own,
+ * preceded by its mm_heap_t handle. The routines work on the heap that
+ * the file-static ptr heap points to, which the mm_heap_* wrappers switch.
+ *
+ * The heads of the free lists are a table in the heap's handle, k of
+ * them, class_head pointing at the first. Each head is a 4-byte offset
+ * relative to heap_listp.
+ *
+ * k is the number of size classes, CLASS_NUM. Class 0 holds the blocks
+ * below 32 bytes; every power of two from pow(2, 5) to
+ * pow(2, CLASS_MAX_LOG2) is split into pow(2, CLASS_SUB_BITS) classes
+ * of equal width, and the last class holds everything larger. Building
+ * with -DCLASS_SUB_BITS=0 -DCLASS_MAX_LOG2=15 gives plain powers of two.
+ *
+ * In TLSF mode there are k = TLSF_LISTS heads instead. First-level class
+ * 0 holds the blocks below 128 bytes, class f > 0 those between
+ * pow(2, f+6) and pow(2, f+7). Each is split into TLSF_SL_NUM lists of
+ * equal width. A bit per first-level class and a bit per list, kept in
+ * the heap's handle, tell which lists are not empty.
  *
  *
  *
@@ -56,6 +98,28 @@
  *
  *
  *
+ * In buddy mode, a block of 4 KB to 1 MB that is within 1/BUDDY_SLACK of
+ * the next power of two is a power-of-two block in a buddy arena, an
+ * allocated block of the heap laid out as
+ * ------------------------------------------------------------------
+ * |  header  |  free bitmap  |  pad  |  pow(2, a) of buddy blocks  |
+ * ------------------------------------------------------------------
+ *            |   64 bytes      4 bytes
+ *            abp                       base
+ * The order a of an arena grows with the number of arenas, up to 1 MB,
+ * so that a few medium blocks do not cost a whole megabyte.
+ * A buddy block has the usual header, with the BUDDY bit set, so its
+ * payload is 8-byte aligned; the bits between the flags and the size,
+ * always a multiple of 4 KB, hold the index of its arena. An arena keeps
+ * its index until it is released. The buddy of the block at offset off from
+ * base with size pow(2, k) is at off ^ pow(2, k). The bitmap holds a bit
+ * per node of the tree of blocks, set while the block is free; free
+ * blocks are linked into a list per order like other free blocks.
+ *
+ *
+ *
+ *
+ *
  * The layout of a free block:
  * ------------------------------------------------------
  * |    header    |   pred   |   succ   |...|   footer  |
@@ -66,12 +130,77 @@
  * The layout of its header/footer is identical to the allocated block header.
  * The pred field stores the offset of the block pointer of its predecessor
  * relative to heap_listp.
+ *
+ * The free block just before the epilogue, if any, is the wilderness. It
+ * is on no list: the heap's handle points to it, so that it is only split
+ * once no listed block fits, and the heap grows into it.
+ *
+ *
+ *
+ *
+ *
+ * In side table mode, the heap is cut into 8-byte granules, granule g
+ * starting at heap_listp + g * 8, so that every block ptr starts one.
+ * A region of the heap's own holds two bitmaps over them, a word of each
+ * per 64 granules, interleaved:
+ * ----------------------------------------------------------------
+ * |  starts 0-63  |  allocs 0-63  |  starts 64-127  |  ...  |
+ * ----------------------------------------------------------------
+ * A bit of starts is set where a block ptr is, the same bit of allocs if
+ * that block is allocated; the epilogue counts as an allocated start.
+ * The size of a block is the distance to the next start, or to the
+ * epilogue. The headers stay as they are, since every routine reads them;
+ * the bitmaps shadow their size and alloc bit. Buddy blocks are not in
+ * them: an arena is one allocated block.
+ * Coalescing takes the alloc bits of both neighbours from the table, and
+ * the block before is the last start below. Only if that is more than
+ * SIDE_SCAN words of the table back, so a block of some KB, are the
+ * prev_alloc bit and the footer read instead.
+ * free ignores a pointer the table shows as no allocated block, which
+ * catches double and wild frees without touching the heap.
+ *
+ *
+ *
+ *
+ *
+ * In concurrent mode, the list of each class has a lock of its own, and
+ * heap growth another; no thread ever waits for a lock while holding
+ * one. An allocated block has a footer as well, and prev_alloc bits are
+ * not kept, as the header of a block belongs to whoever holds it:
+ *   - a free block, to the holder of the lock of its class; its tags say
+ *     free exactly while it is on that list;
+ *   - any other block, to the thread that took it off a list, carved it
+ *     out of fresh heap or owns it as allocated; it looks allocated to
+ *     all others, even while it is being split or merged.
+ * A neighbour is merged by reading its tags unlocked, try-locking the
+ * class they give, and reading them again: if they still say free, the
+ * neighbour is on that list. Prev is taken before next, so in address
+ * order. When the lock is busy or the tags changed, the block is put on
+ * its list without that neighbour, and the two may stay apart.
+ * The other modes are off in a concurrent heap.
+ *
+ *
+ *
+ *
+ *
+ * A thread other than the owner of a heap frees a block of it with
+ * mm_heap_free_remote, which takes no lock: the block is pushed on the
+ * remote free queue of the heap, a stack linked through the pred slot
+ * of its blocks, whose top is an offset in the heap's handle set by
+ * compare-and-swap. The owner takes the whole stack with one atomic
+ * exchange at its next malloc, and frees it in batches. As nothing is
+ * ever popped off the stack by itself, it needs no guard against ABA.
  */
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -107,14 +236,57 @@
 /* Constants and macros */
 #define WSIZE 4             /* word size (bytes) */
 #define DSIZE 8             /* double word size (bytes) */
-#define CHUNKSIZE (1 << 11) /* Extend heap by this amount (bytes) */
+#define CHUNKSIZE (1 << 11) /* Extend heap by at least this amount (bytes) */
+#define CHUNKMAX (1 << 16)  /* Extend heap by at most this amount (bytes) */
+#define GROW_WINDOW 16      /* extensions within this many mallocs: grow */
+#define STABLE_WINDOW 1024  /* each such many mallocs without one: shrink */
+#define CHUNKDIV 64         /* nor by more than 1/this of the heap */
 #define INITSIZE (1 << 11)  /* initialize heap by this amount (bytes) */
-#define CLASS_NUM 12        /* number of size classes */
+#ifndef CLASS_SUB_BITS
+#define CLASS_SUB_BITS 2    /* log2 of classes per power of two */
+#endif
+#ifndef CLASS_MAX_LOG2
+#define CLASS_MAX_LOG2 20   /* blocks from pow(2, this) on share a class */
+#endif
+#if CLASS_SUB_BITS > 3
+#error "CLASS_SUB_BITS above 3 splits 32-byte blocks and overflows heap maps"
+#endif
+#define CLASS_SUB (1 << CLASS_SUB_BITS)
+#define CLASS_NUM (((CLASS_MAX_LOG2 - 5) << CLASS_SUB_BITS) + 2) /* classes */
+#define CLASS_GROUPS ((CLASS_NUM + 3) / 4) /* classes compared at once: 4 */
+#define ARENA_CHUNKSIZE (1 << 12) /* arena chunk payload (bytes) */
+#define CACHELINE 64        /* cache line size (bytes) */
+#ifndef LINE_SCAN
+#define LINE_SCAN 8         /* free blocks tried for a line-aligned fit */
+#endif
+#define SPLIT_CLASS (((8 - 5) << CLASS_SUB_BITS) + 1) /* class of 256 bytes */
+
+#define TLSF_SL_BITS 3                         /* log2 of lists per class */
+#define TLSF_SL_NUM (1 << TLSF_SL_BITS)        /* second-level lists */
+#define TLSF_FL_SHIFT 7                        /* class 0: below 1 << 7 */
+#define TLSF_FL_NUM (32 - TLSF_FL_SHIFT + 1)   /* first-level classes */
+#define TLSF_LISTS (TLSF_FL_NUM * TLSF_SL_NUM) /* number of TLSF lists */
+
+#define BUDDY_MIN_ORDER 12  /* smallest buddy block: 4 KB */
+#define BUDDY_MAX_ORDER 20  /* largest buddy block and arena: 1 MB */
+#define BUDDY_ORDERS (BUDDY_MAX_ORDER - BUDDY_MIN_ORDER + 1)
+#define BUDDY_MAP 64        /* free bitmap bytes of an arena, 2 bits a leaf */
+#define BUDDY_ARENAS 128    /* most buddy arenas of a heap */
+#define BUDDY_SLACK 32      /* buddy blocks waste under 1/this of their size */
+
+#define SIDE_SCAN 4         /* words of starts searched for a block before */
+
+#define REMOTE_BATCH 64     /* remote frees given back at once */
+#define MT_CHUNK (1 << 12)  /* concurrent mode extends the heap by this much */
+
+/* size of the table of list heads, enough for either kind of list */
+#define LIST_NUM (CLASS_NUM > TLSF_LISTS ? CLASS_NUM : TLSF_LISTS)
 
 #define PREV_ALLOCATED 2 /* previous block is allocated */
 #define PREV_FREE 0      /* previous block is free */
 #define ALLOCATED 1      /* current block is allocated */
 #define FREE 0           /* current block is free */
+#define BUDDY 4          /* current block lives in a buddy arena */
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
@@ -133,6 +305,14 @@
 #define GET_PREV_ALLOC(p) (GET(p) & 0x2)
 /* Read allocated bit from address p */
 #define GET_ALLOC(p) (GET(p) & 0x1)
+/* Given block ptr bp, whether it lives in a buddy arena */
+#define IS_BUDDY(bp) (GET(HDRP(bp)) & BUDDY)
+/* Arena index i as kept in the header bits of a buddy block below its
+   size, and read back from the block ptr bp of one */
+#define BUDDY_TAG(i) ((unsigned int)(i) << 3)
+#define BUDDY_ARENA(bp) ((GET(HDRP(bp)) >> 3) & (BUDDY_ARENAS - 1))
+/* Given block ptr bp of a buddy block, compute its size */
+#define BUDDY_SIZE(bp) (GET(HDRP(bp)) & ~((1U << BUDDY_MIN_ORDER) - 1))
 
 /* Given block ptr bp, compute address of its header */
 #define HDRP(bp) ((char *)(bp)-WSIZE)
@@ -148,30 +328,162 @@
 /* Given block ptr bp, compute address of previous block */
 #define PREV_BLKP(bp) ((char *)(bp)-GET_SIZE(((char *)(bp)-DSIZE)))
 /* Given block ptr bp, compute address of its predecessor */
-#define PRED_BLKP(bp) ((long)GET(PREDP(bp)) + heap_listp)
+#define PRED_BLKP(bp) ((long)GET(PREDP(bp)) + heap->heap_listp)
 /* Given block ptr bp, compute address of its successor */
-#define SUCC_BLKP(bp) ((long)GET(SUCCP(bp)) + heap_listp)
+#define SUCC_BLKP(bp) ((long)GET(SUCCP(bp)) + heap->heap_listp)
+
+/* Hint that the line at address p is read soon; built with
+   -DUSE_PREFETCH only, as it pays off on large heaps alone */
+#ifdef USE_PREFETCH
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)0)
+#endif
+
+/* Write the header of block bp, and its bits in the side table */
+#define PUT_HDR(bp, val)                                                   \
+    (PUT(HDRP(bp), (val)),                                                 \
+     heap->side ? side_mark((bp), (val)&ALLOCATED) : (void)0)
+/* Given block ptr bp, compute its granule in the side table */
+#define SIDE_GRAN(bp) ((size_t)((char *)(bp)-heap->heap_listp) / DSIZE)
 
 /* Address/offset conversion */
-#define A2O(bp) ((unsigned int)((char *)bp - heap_listp))
+#define A2O(bp) ((unsigned int)((char *)bp - heap->heap_listp))
 /* Offset/address conversion */
-#define O2A(off) ((long)off + heap_listp)
+#define O2A(off) ((long)off + heap->heap_listp)
+
+/*
+ * An arena hands out memory by bumping cur inside its current chunk.
+ * Chunks are ordinary allocated blocks; the first double word of each
+ * holds the offset of the previous chunk, so that the whole chain can
+ * be handed back to the free lists at once.
+ */
+struct mm_arena
+{
+    char *chunk; /* current chunk, NULL if none */
+    char *cur;   /* next free byte in the current chunk */
+    char *end;   /* end of the current chunk's payload */
+};
+
+/*
+ * All state of one heap. The default heap serves malloc/free/realloc/
+ * calloc; the handle of a heap made by mm_heap_create sits at the bottom
+ * of its own region, in front of the prologue.
+ */
+struct mm_heap
+{
+    /* ptr to prologue */
+    char *heap_listp;
+    /* ptr to start address of segretated free lists, in heads */
+    char *class_head;
+    unsigned int heads[LIST_NUM];
+    /* size of the largest block of each class, 0 if it is empty; padded
+       with empty classes to whole groups of 4 */
+    unsigned int class_max[CLASS_GROUPS * 4];
+    /* current heap extension amount, adapted to the recent growth rate */
+    size_t chunksize;
+    /* number of mallocs since the last heap extension */
+    unsigned int malloc_cnt;
+    /* the memory region the heap grows in */
+    mem_region_t *region;
+    /* huge page size of the region, 0 if it has regular pages */
+    size_t hugepage;
+    /* cache line small blocks are aligned to, 0 if they are packed */
+    size_t line;
+    /* first class placed at the high end of a free block: SPLIT_CLASS in
+       split placement mode, else CLASS_NUM, which no block reaches */
+    unsigned int split;
+    /* number of free lists: CLASS_NUM, or TLSF_LISTS in TLSF mode */
+    unsigned int lists;
+    /* the free block before the epilogue, on no list; NULL if none */
+    char *wild;
+    /* TLSF mode: the non-empty first-level classes and, per class, its
+       non-empty lists */
+    int tlsf;
+    unsigned int fl_bitmap;
+    unsigned char sl_bitmap[TLSF_FL_NUM];
+    /* buddy mode: the free list of each order, a bit per non-empty
+       list, and the arenas */
+    int buddy;
+    unsigned int buddy_map;
+    unsigned int buddy_head[BUDDY_ORDERS];
+    int buddy_arenas;
+    char *buddy_arena[BUDDY_ARENAS];
+    unsigned char buddy_order[BUDDY_ARENAS];
+    /* side table mode: the bitmaps, NULL if off, the words of them in
+       use, and the region they live in, NULL until first needed */
+    unsigned long *side;
+    size_t side_words;
+    mem_region_t *side_region;
+    /* concurrent mode: the lock of each class list, and the lock of
+       heap growth */
+    int mt;
+    pthread_mutex_t class_lock[CLASS_NUM];
+    pthread_mutex_t grow_lock;
+    /* the remote free queue: offset of the last block queued, 0 if none */
+    unsigned int remote;
+    /* list walks: searches of the ordered lists and the links they
+       followed, ordered inserts and the links they followed; only
+       approximate in concurrent mode */
+    unsigned long fits, fit_steps;
+    unsigned long inserts, insert_steps;
+};
 
 /* Global variables */
-/* ptr to prologue */
-static char *heap_listp = 0;
-/* ptr to start address of segretated free lists */
-static char *class_head = 0;
+/* the heap behind malloc/free/realloc/calloc */
+static mm_heap_t default_heap;
+/* the heap being operated on, per thread so that threads may work on
+   different heaps at the same time */
+static __thread mm_heap_t *heap = &default_heap;
+/* if set, heaps initialized from now on are in cache line mode */
+static int cacheline_mode = 0;
+/* if set, heaps initialized from now on are in TLSF mode */
+static int tlsf_mode = 0;
+/* if set, heaps initialized from now on are in buddy mode */
+static int buddy_mode = 0;
+/* if set, heaps initialized from now on are in split placement mode */
+static int split_mode = 0;
+/* if set, heaps initialized from now on are in side table mode */
+static int side_mode = 0;
+/* if set, heaps initialized from now on are in concurrent mode */
+static int concurrent_mode = 0;
 
 /* Helper routines */
 static inline void *extend_heap(size_t words);
 static inline void *coalesce(void *bp);
 static inline void *get_class_ptr(void *bp);
+static inline unsigned int size_class(unsigned int size);
+static inline unsigned int tlsf_index(unsigned int size);
+static inline unsigned int list_index(unsigned int size);
+static inline void *tlsf_find(size_t asize);
 static inline void del_free_list(void *bp);
 static inline void add_free_list(void *bp);
+static inline unsigned int fit_class(unsigned int i, size_t asize);
 static inline void *find_fit(size_t asize);
-static inline void place(void *bp, size_t asize);
+static inline void *wild_fit(size_t asize);
+static inline void *place(void *bp, size_t asize);
+static inline size_t line_pad(void *bp);
+static inline void *find_line_fit(size_t asize, size_t fitsize);
+static inline void *align_line(void *bp);
+static inline int buddy_fits(size_t asize);
+static inline void *buddy_malloc(size_t asize);
+static inline void buddy_free(void *bp);
+static inline size_t grow_size(size_t asize);
+static inline void trim_block(void *bp);
+static inline int side_grow(size_t size);
+static inline void side_mark(void *bp, unsigned int alloc);
+static inline void side_clear(void *bp);
+static inline size_t side_next(size_t g, size_t end);
+static inline void *side_prev(void *bp);
+static inline unsigned int side_alloc(void *bp);
+static inline void *mt_malloc(size_t size);
+static inline void mt_release(char *bp);
+static inline void *mt_realloc(void *oldbp, size_t size);
+static inline void drain_remote(void);
+static inline size_t adjust_size(size_t size);
+static int addr_cmp(const void *p, const void *q);
 static void print_heap(void);
+static int init_heap(void);
 
 /*
  * mm_init - initialize the memory
@@ -179,31 +491,87 @@ static void print_heap(void);
  */
 int mm_init(void)
 {
-    dbg_printf("\ninit\n");
+    default_heap.region = mem_default_region();
+    return init_heap();
+}
 
-    /* initialize global variables */
-    heap_listp = 0;
-    class_head = 0;
+/*
+ * init_heap - lay out an empty heap at the brk of the current region
+ * return -1 on error, 0 on success.
+ */
+static int init_heap(void)
+{
+    dbg_printf("\ninit\n");
 
-    /* allocate heap with headers, possible padding, prologue and epilogue */
-    int padding = CLASS_NUM % 2 ? 0 : 1;
-    class_head = mem_sbrk((CLASS_NUM + padding + 3) * WSIZE);
-    if (class_head == (void *)-1)
-        return -1;
+    /* initialize heap state */
+    heap->heap_listp = 0;
+    heap->class_head = (char *)heap->heads;
+    heap->chunksize = CHUNKSIZE;
+    heap->malloc_cnt = 0;
+    heap->hugepage = mem_region_hugepage(heap->region);
+    heap->mt = concurrent_mode;
+    heap->line = (cacheline_mode && !heap->mt) ? CACHELINE : 0;
+    heap->split = (split_mode && !heap->mt) ? SPLIT_CLASS : CLASS_NUM;
+    heap->wild = NULL;
+    heap->tlsf = tlsf_mode && !heap->mt;
+    heap->lists = heap->tlsf ? TLSF_LISTS : CLASS_NUM;
+    heap->fl_bitmap = 0;
+    memset(heap->sl_bitmap, 0, sizeof(heap->sl_bitmap));
+    heap->buddy = buddy_mode && !heap->mt;
+    heap->buddy_map = 0;
+    memset(heap->buddy_head, 0, sizeof(heap->buddy_head));
+    heap->buddy_arenas = 0;
+    memset(heap->buddy_arena, 0, sizeof(heap->buddy_arena));
+    heap->side = NULL;
+    heap->side_words = 0;
+    heap->remote = 0;
+    heap->fits = heap->fit_steps = 0;
+    heap->inserts = heap->insert_steps = 0;
 
     /* header points to heap_listp at start */
-    memset(class_head, 0, CLASS_NUM * WSIZE);
+    memset(heap->heads, 0, sizeof(heap->heads));
+    memset(heap->class_max, 0, sizeof(heap->class_max));
+
+    /* allocate heap with padding, prologue and epilogue */
+    heap->heap_listp = mem_region_sbrk(heap->region, 4 * WSIZE);
+    if (heap->heap_listp == (void *)-1)
+    {
+        heap->heap_listp = 0;
+        return -1;
+    }
 
-    heap_listp = class_head + (CLASS_NUM + padding) * WSIZE;
+    /* padding */
+    PUT(heap->heap_listp, 0);
+    heap->heap_listp += 1 * WSIZE;
     /* prologue header */
-    PUT(heap_listp, PACK(DSIZE, PREV_ALLOCATED, ALLOCATED));
-    /* prologue padding */
-    PUT(heap_listp + 1 * WSIZE, 0);
+    PUT(heap->heap_listp, PACK(DSIZE, PREV_ALLOCATED, ALLOCATED));
+    /* prologue footer, read by the first block in concurrent mode */
+    PUT(heap->heap_listp + 1 * WSIZE, PACK(DSIZE, PREV_ALLOCATED, ALLOCATED));
     /* epilogue header */
-    PUT(heap_listp + 2 * WSIZE, PACK(0, PREV_ALLOCATED, ALLOCATED));
+    PUT(heap->heap_listp + 2 * WSIZE, PACK(0, PREV_ALLOCATED, ALLOCATED));
 
     /* finally set the value of heap_listp */
-    heap_listp += 1 * WSIZE;
+    heap->heap_listp += 1 * WSIZE;
+
+    if (heap->mt)
+    {
+        for (int i = 0; i < CLASS_NUM; i++)
+            pthread_mutex_init(&heap->class_lock[i], NULL);
+        pthread_mutex_init(&heap->grow_lock, NULL);
+    }
+
+    /* start the side table over, with the prologue in it */
+    if (side_mode && !heap->mt)
+    {
+        if (heap->side_region)
+            mem_region_reset_brk(heap->side_region);
+        else if ((heap->side_region = mem_region_create()) == NULL)
+            return -1;
+        heap->side = mem_region_lo(heap->side_region);
+        if (side_grow(0) < 0)
+            return -1;
+        side_mark(heap->heap_listp, ALLOCATED);
+    }
 
     /* extend heap, add it to free lists and set the value of epilogue */
     void *bp = extend_heap(INITSIZE / WSIZE);
@@ -213,6 +581,67 @@ int mm_init(void)
     return 0;
 }
 
+/*
+ * mm_set_cacheline - put the heaps initialized from now on in cache line
+ * mode (on != 0), where a block of at most a cache line is aligned to a
+ * line and fills it, or pack them as usual (on == 0)
+ */
+void mm_set_cacheline(int on)
+{
+    cacheline_mode = on;
+}
+
+/*
+ * mm_set_tlsf - put the heaps initialized from now on in TLSF mode
+ * (on != 0), where malloc and free take bounded time, or use the ordered
+ * segregated lists (on == 0)
+ */
+void mm_set_tlsf(int on)
+{
+    tlsf_mode = on;
+}
+
+/*
+ * mm_set_buddy - put the heaps initialized from now on in buddy mode
+ * (on != 0), where blocks of 4 KB to 1 MB just under a power of two come
+ * from buddy arenas, or keep all blocks on the free lists (on == 0)
+ */
+void mm_set_buddy(int on)
+{
+    buddy_mode = on;
+}
+
+/*
+ * mm_set_split - put the heaps initialized from now on in split placement
+ * mode (on != 0), where blocks of 256 bytes and up are carved from the
+ * high end of a free block and smaller ones from the low end, or carve
+ * all blocks from the low end (on == 0)
+ */
+void mm_set_split(int on)
+{
+    split_mode = on;
+}
+
+/*
+ * mm_set_sidetable - put the heaps initialized from now on in side table
+ * mode (on != 0), where bitmaps outside the heap tell where blocks start
+ * and which are allocated, or keep that in the headers alone (on == 0)
+ */
+void mm_set_sidetable(int on)
+{
+    side_mode = on;
+}
+
+/*
+ * mm_set_concurrent - put the heaps initialized from now on in concurrent
+ * mode (on != 0), where any number of threads may use them at once, or
+ * leave them to one thread at a time (on == 0)
+ */
+void mm_set_concurrent(int on)
+{
+    concurrent_mode = on;
+}
+
 /*
  * malloc - Allocate a block with at least size bytes of payload
  * return NULL on error, block ptr on success.
@@ -221,32 +650,50 @@ void *malloc(size_t size)
 {
     dbg_printf("\nmalloc %lu\n", size);
 
-    size_t asize, extendsize;
+    size_t asize, fitsize, extendsize;
     void *bp;
-    if (heap_listp == 0)
+    if (heap->heap_listp == 0)
         mm_init();
 
+    /* blocks other threads freed go back before anything is taken */
+    if (__atomic_load_n(&heap->remote, __ATOMIC_RELAXED))
+        drain_remote();
+
     if (size == 0)
         return NULL;
 
+    if (heap->mt)
+        return mt_malloc(size);
+
+    heap->malloc_cnt++;
+
     /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= 3 * WSIZE)
-        asize = 4 * WSIZE;
-    else
-        asize = DSIZE * ((size + (WSIZE) + (DSIZE - 1)) / DSIZE);
+    asize = adjust_size(size);
 
-    if ((bp = find_fit(asize)) != NULL)
+    if (heap->buddy && buddy_fits(asize))
+        return buddy_malloc(asize);
+
+    /* a small block in cache line mode takes a whole line, and may need
+       room in front of it to get aligned */
+    fitsize = asize;
+    if (heap->line && asize <= heap->line)
     {
-        place(bp, asize);
+        asize = heap->line;
+        fitsize = asize + heap->line + 2 * DSIZE;
     }
-    else
+
+    bp = (fitsize == asize) ? find_fit(asize)
+                            : find_line_fit(asize, fitsize);
+    if (bp == NULL)
     {
-        extendsize = MAX(asize, CHUNKSIZE);
+        extendsize = grow_size(fitsize);
         bp = extend_heap(extendsize / WSIZE);
         if (bp == NULL)
             return NULL;
-        place(bp, asize);
     }
+    if (fitsize != asize)
+        bp = align_line(bp);
+    bp = place(bp, asize);
 
     dbg_printf("after malloc:\n");
     PRINT();
@@ -266,13 +713,37 @@ void free(void *bp)
     if (!bp)
         return;
 
+    if (heap->mt)
+    {
+        mt_release(bp);
+        return;
+    }
+
+    if (IS_BUDDY(bp))
+    {
+        buddy_free(bp);
+        return;
+    }
+
+    /* the side table knows every allocated block: drop anything else */
+    if (heap->side && !side_alloc(bp))
+    {
+        dbg_printf("\nfree: %u is no allocated block", A2O(bp));
+        return;
+    }
+
     size = GET_SIZE(HDRP(bp));
-    if (!heap_listp)
+    if (!heap->heap_listp)
         mm_init();
 
-    /* set header and footer of this block*/
+    /* fetch the neighbours' headers while this one is written */
     unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
-    PUT(HDRP(bp), PACK(size, prev_alloc, FREE));
+    PREFETCH(HDRP(NEXT_BLKP(bp)));
+    if (!prev_alloc)
+        PREFETCH(HDRP(PREV_BLKP(bp)));
+
+    /* set header and footer of this block*/
+    PUT_HDR(bp, PACK(size, prev_alloc, FREE));
     PUT(FTRP(bp), PACK(size, prev_alloc, FREE));
 
     /* set header (and footer) of next block */
@@ -283,11 +754,42 @@ void free(void *bp)
         PUT(FTRP(NEXT_BLKP(bp)), PACK(next_size, PREV_FREE, next_alloc));
 
     bp = coalesce(bp);
+    trim_block(bp);
 
     dbg_printf("after free:\n");
     PRINT();
 }
 
+/*
+ * mm_free_sized - free a block whose payload size is known to the caller
+ * A block is at most DSIZE larger than adjust_size(size), since place
+ * never splits off less than a minimum block; in cache line mode, a
+ * small block is at most DSIZE larger than the line. The size is not
+ * used to skip work: the header word free reads for the size also holds
+ * the prev_alloc and BUDDY bits it needs, and the class a freed block
+ * goes to is that of the block after coalescing, which the size does not
+ * tell. It only serves for validation in the debug build.
+ */
+void mm_free_sized(void *bp, size_t size)
+{
+#ifdef DEBUG
+    if (bp && !IS_BUDDY(bp) && !heap->mt)
+    {
+        size_t asize = adjust_size(size);
+        if (heap->line && asize <= heap->line)
+            asize = heap->line;
+        if (GET_SIZE(HDRP(bp)) < asize || GET_SIZE(HDRP(bp)) > asize + DSIZE)
+        {
+            printf("Error: sized free of %lu bytes, but block %u has size %u\n",
+                   size, A2O(bp), GET_SIZE(HDRP(bp)));
+            print_heap();
+            exit(0);
+        }
+    }
+#endif
+    free(bp);
+}
+
 /*
  * realloc - reallocte the old block
  * uses the old block and next free block if possible.
@@ -319,22 +821,51 @@ void *realloc(void *oldbp, size_t size)
         return ret;
     }
 
-    size_t oldsize, freesize = 0, asize;
+    if (heap->mt)
+        return mt_realloc(oldbp, size);
+
+    size_t oldsize, freesize = 0, asize, extendsize;
     unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(oldbp));
     void *newbp, *freebp, *nextbp;
 
     /* the size of this block */
     oldsize = GET_SIZE(HDRP(oldbp));
 
+    /* a buddy block stays if it is still the right order, else moves */
+    if (IS_BUDDY(oldbp))
+    {
+        oldsize = BUDDY_SIZE(oldbp);
+        asize = adjust_size(size);
+        if (asize <= oldsize && asize > oldsize / 2)
+            return oldbp;
+        if ((newbp = mm_malloc(size)) == NULL)
+            return 0;
+        memcpy(newbp, oldbp, MIN(size, oldsize - WSIZE));
+        mm_free(oldbp);
+        return newbp;
+    }
+
     /* the size of next block if it is free */
     if (!GET_ALLOC(HDRP(NEXT_BLKP(oldbp))))
         freesize = GET_SIZE(HDRP(NEXT_BLKP(oldbp)));
 
     /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= 3 * WSIZE)
-        asize = 4 * WSIZE;
-    else
-        asize = DSIZE * ((size + (WSIZE) + (DSIZE - 1)) / DSIZE);
+    asize = adjust_size(size);
+    if (heap->line && asize <= heap->line)
+        asize = heap->line;
+
+    /* the block ends the heap, or only the wilderness follows it: grow
+       the heap by the shortfall instead of moving the block; this is no
+       malloc, so the adaptive chunk size is left alone */
+    nextbp = NEXT_BLKP(oldbp);
+    if (oldsize + freesize < asize &&
+        (!GET_SIZE(HDRP(nextbp)) || nextbp == heap->wild))
+    {
+        extendsize = MAX(ALIGN(asize - oldsize - freesize), 2 * DSIZE);
+        if (extend_heap(extendsize / WSIZE) == NULL)
+            return 0;
+        freesize = GET_SIZE(HDRP(NEXT_BLKP(oldbp)));
+    }
 
     /* need not copy */
     if (oldsize + freesize >= asize)
@@ -343,14 +874,18 @@ void *realloc(void *oldbp, size_t size)
         if (oldsize + freesize >= asize + (2 * DSIZE))
         {
             if (freesize)
+            {
                 del_free_list(NEXT_BLKP(oldbp));
+                if (heap->side)
+                    side_clear(NEXT_BLKP(oldbp));
+            }
 
             /* set header of this block */
             PUT(HDRP(oldbp), PACK(asize, prev_alloc, ALLOCATED));
 
             /* set header and footer of next free block */
             freebp = NEXT_BLKP(oldbp);
-            PUT(HDRP(freebp),
+            PUT_HDR(freebp,
                 PACK(oldsize + freesize - asize, PREV_ALLOCATED, FREE));
             PUT(FTRP(freebp),
                 PACK(oldsize + freesize - asize, PREV_ALLOCATED, FREE));
@@ -370,7 +905,11 @@ void *realloc(void *oldbp, size_t size)
         else
         {
             if (freesize)
+            {
                 del_free_list(NEXT_BLKP(oldbp));
+                if (heap->side)
+                    side_clear(NEXT_BLKP(oldbp));
+            }
             PUT(HDRP(oldbp), PACK(oldsize + freesize, prev_alloc, ALLOCATED));
 
             if (freesize)
@@ -426,102 +965,554 @@ void *calloc(size_t nmemb, size_t size)
 }
 
 /*
- * Return whether the pointer is in the heap.
+ * mm_malloc_batch - allocate n blocks with at least size bytes of payload
+ * each, carved back to back from a single free span. They are packed even
+ * in cache line mode, as one caller owns them all.
+ * returns the number of block ptrs stored in out: n on success, 0 on error.
  */
-static int in_heap(const void *p)
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
 {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
-}
+    dbg_printf("\nmalloc_batch %lu x %lu\n", n, size);
 
-/*
- * Return whether the pointer is aligned.
- */
-static int aligned(const void *p)
-{
-    return (size_t)ALIGN(p) == (size_t)p;
+    size_t asize, total, csize, i;
+    char *bp;
+
+    if (heap->heap_listp == 0)
+        mm_init();
+
+    if (size == 0 || n == 0)
+        return 0;
+
+    /* a concurrent heap has no span to itself: one block at a time */
+    if (heap->mt)
+    {
+        for (i = 0; i < n; i++)
+            if ((out[i] = malloc(size)) == NULL)
+            {
+                mm_free_batch(out, i);
+                return 0;
+            }
+        return n;
+    }
+
+    /* the span must fit the size field of a header */
+    asize = adjust_size(size);
+    if (asize > UINT_MAX || n > UINT_MAX / asize)
+        return 0;
+    heap->malloc_cnt += n;
+    total = asize * n;
+
+    if ((bp = find_fit(total)) == NULL)
+    {
+        bp = extend_heap(grow_size(total) / WSIZE);
+        if (bp == NULL)
+            return 0;
+    }
+
+    /* unlink the span once, then lay the blocks down one after another */
+    csize = GET_SIZE(HDRP(bp));
+    del_free_list(bp);
+    for (i = 0; i < n; i++, bp += asize)
+    {
+        out[i] = bp;
+        PUT_HDR(bp, PACK(asize, PREV_ALLOCATED, ALLOCATED));
+    }
+
+    /* need split: link the remainder back once */
+    if ((csize - total) >= (2 * DSIZE))
+    {
+        PUT_HDR(bp, PACK(csize - total, PREV_ALLOCATED, FREE));
+        PUT(FTRP(bp), PACK(csize - total, PREV_ALLOCATED, FREE));
+
+        add_free_list(bp);
+    }
+    /* should not split: the last block takes the remainder */
+    else
+    {
+        bp -= asize;
+        PUT(HDRP(bp), PACK(asize + csize - total, PREV_ALLOCATED, ALLOCATED));
+
+        unsigned int next_size = GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(next_size, PREV_ALLOCATED, ALLOCATED));
+    }
+
+    dbg_printf("after malloc_batch:\n");
+    PRINT();
+
+    return n;
 }
 
 /*
- * mm_checkheap - check almost everything
+ * mm_free_batch - free n blocks at once
+ * ptrs is sorted by address in place, so that every run of physically
+ * adjacent blocks is freed and coalesced as a single block.
  */
-void mm_checkheap(int lineno)
+void mm_free_batch(void **ptrs, size_t n)
 {
-    dbg_printf("\nin check_heap\n");
-    if (GET(heap_listp - WSIZE) != PACK(DSIZE, PREV_ALLOCATED, ALLOCATED))
-    {
-        printf("Error: line %d, invalid prologue %u\n",
-               lineno, GET(heap_listp - WSIZE));
-        exit(0);
-    }
+    dbg_printf("\nfree_batch %lu\n", n);
+
+    size_t i, j;
+    char *bp;
+    unsigned int size, next_size, next_alloc, prev_alloc;
+
+    if (!heap->heap_listp)
+        mm_init();
 
-    if ((GET(mem_heap_hi() - 3) & ~0x2) != PACK(0, PREV_FREE, ALLOCATED))
+    if (heap->mt)
     {
-        printf("Error: line %d, invalid epilogue %u\n", lineno, GET(mem_heap_hi() - 3));
-        exit(0);
+        for (i = 0; i < n; i++)
+            free(ptrs[i]);
+        return;
     }
 
-    /* check blocks one by one */
-    char *prev_bp = 0;
-    int heap_free_cnt = 0, list_free_cnt = 0;
-    for (char *bp = heap_listp; bp < (char *)mem_heap_hi();
-         prev_bp = bp, bp = NEXT_BLKP(bp))
+    qsort(ptrs, n, sizeof(void *), addr_cmp);
+
+    for (i = 0; i < n; i = j)
     {
-        if (!GET_ALLOC(HDRP(bp)))
+        bp = ptrs[i];
+        j = i + 1;
+        if (!bp)
+            continue;
+        if (IS_BUDDY(bp))
         {
-            heap_free_cnt++;
+            buddy_free(bp);
+            continue;
         }
 
-        if (!aligned(bp))
+        /* grow the run while the next ptr is the physical neighbour */
+        size = GET_SIZE(HDRP(bp));
+        for (; j < n && (char *)ptrs[j] == bp + size; j++)
         {
-            printf("Error: line %d, unaligned block (%u; %u)\n",
-                   lineno, A2O(HDRP(bp)),
-                   A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1));
-            print_heap();
-            exit(0);
+            size += GET_SIZE(HDRP(ptrs[j]));
+            if (heap->side)
+                side_clear(ptrs[j]);
         }
 
-        if (!in_heap(HDRP(bp)) || !in_heap(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1))
-        {
-            printf("Error: line %d, block (%u; %u) outside heap (%u; %u)\n ",
-                   lineno,
-                   A2O(HDRP(bp)), A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1),
-                   A2O(mem_heap_lo()), A2O(mem_heap_hi()));
-            print_heap();
-            exit(0);
-        }
+        /* set header and footer of the whole run */
+        prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+        PUT_HDR(bp, PACK(size, prev_alloc, FREE));
+        PUT(FTRP(bp), PACK(size, prev_alloc, FREE));
 
-        if (bp != heap_listp && GET_SIZE(HDRP(bp)) < 2 * DSIZE)
-        {
-            printf("Error: line %d, block size too small (%u; %u)\n",
-                   lineno, A2O(HDRP(bp)),
-                   A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1));
-            print_heap();
-            exit(0);
-        }
+        /* set header (and footer) of next block */
+        next_size = GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(next_size, PREV_FREE, next_alloc));
+        if (!next_alloc)
+            PUT(FTRP(NEXT_BLKP(bp)), PACK(next_size, PREV_FREE, next_alloc));
 
-        if (prev_bp &&
-            GET_ALLOC(HDRP(prev_bp)) != (GET_PREV_ALLOC(HDRP(bp)) >> 1))
-        {
-            printf("Error: line %d, inconsistent alloc bit.\n", lineno);
-            printf("Prev header %u alloc %u cur header %u prev_alloc %u\n",
-                   A2O(HDRP(prev_bp)), GET_ALLOC(HDRP(prev_bp)),
-                   A2O(HDRP(bp)), (GET_PREV_ALLOC(HDRP(bp)) >> 1));
-            print_heap();
-            exit(0);
-        }
+        trim_block(coalesce(bp));
+    }
 
-        if (!GET_ALLOC(HDRP(bp)) && GET_ALLOC(FTRP(bp)))
-        {
-            printf("Error: line %d, inconsistent alloc bit in free (%u; %u)\n",
-                   lineno, A2O(HDRP(bp)),
-                   A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1));
-            print_heap();
-            exit(0);
-        }
+    dbg_printf("after free_batch:\n");
+    PRINT();
+}
 
-        if (prev_bp && !GET_ALLOC(HDRP(prev_bp)) && !GET_ALLOC(HDRP(bp)))
-        {
-            printf("Error: line %d, contiguous free blocks (%u; %u)\n",
+/*
+ * mm_arena_create - create an empty arena
+ * returns NULL on error, arena ptr on success.
+ */
+mm_arena_t *mm_arena_create(void)
+{
+    mm_arena_t *arena = malloc(sizeof(mm_arena_t));
+    if (arena == NULL)
+        return NULL;
+
+    arena->chunk = NULL;
+    arena->cur = NULL;
+    arena->end = NULL;
+    return arena;
+}
+
+/*
+ * mm_arena_alloc - allocate size bytes from arena by bumping its pointer,
+ * starting a new chunk when the current one is exhausted.
+ * The memory is released only by mm_arena_reset or mm_arena_destroy.
+ * returns NULL on error, ptr on success.
+ */
+void *mm_arena_alloc(mm_arena_t *arena, size_t size)
+{
+    dbg_printf("\narena_alloc %lu\n", size);
+
+    char *bp;
+
+    if (size == 0)
+        return NULL;
+
+    size = ALIGN(size);
+    if (arena->end - arena->cur < (long)size)
+    {
+        bp = malloc(MAX(size, ARENA_CHUNKSIZE) + DSIZE);
+        if (bp == NULL)
+            return NULL;
+
+        /* link the new chunk in front of the chain */
+        PUT(bp, arena->chunk ? A2O(arena->chunk) : 0);
+        arena->chunk = bp;
+        arena->cur = bp + DSIZE;
+        arena->end = bp + GET_SIZE(HDRP(bp)) - WSIZE;
+    }
+
+    bp = arena->cur;
+    arena->cur += size;
+    return bp;
+}
+
+/*
+ * mm_arena_reset - free everything allocated from arena, handing its
+ * chunks back to the free lists. The arena can be used again.
+ */
+void mm_arena_reset(mm_arena_t *arena)
+{
+    dbg_printf("\narena_reset\n");
+
+    char *bp, *prev;
+
+    for (bp = arena->chunk; bp; bp = prev)
+    {
+        prev = GET(bp) ? O2A(GET(bp)) : NULL;
+        free(bp);
+    }
+
+    arena->chunk = NULL;
+    arena->cur = NULL;
+    arena->end = NULL;
+}
+
+/*
+ * mm_arena_destroy - reset arena and free the arena itself
+ */
+void mm_arena_destroy(mm_arena_t *arena)
+{
+    mm_arena_reset(arena);
+    free(arena);
+}
+
+/*
+ * mm_heap_create - create a heap in a region of its own, independent of
+ * the default heap and of every other heap.
+ * return NULL on error, heap handle on success.
+ */
+mm_heap_t *mm_heap_create(void)
+{
+    mem_region_t *region = mem_region_create();
+    mm_heap_t *h;
+
+    if (region == NULL)
+        return NULL;
+
+    /* the handle lives at the bottom of the region */
+    h = mem_region_sbrk(region, ALIGN(sizeof(mm_heap_t)));
+    if (h == (void *)-1)
+    {
+        mem_region_destroy(region);
+        return NULL;
+    }
+    h->region = region;
+    h->side_region = NULL;
+
+    if (mm_heap_reset(h) < 0)
+    {
+        mm_heap_destroy(h);
+        return NULL;
+    }
+    return h;
+}
+
+/*
+ * mm_heap_reset - free every block of heap h at once
+ * return -1 on error, 0 on success.
+ */
+int mm_heap_reset(mm_heap_t *h)
+{
+    mm_heap_t *old = heap;
+    int ret;
+
+    /* give back everything but the handle, which stays where it is */
+    mem_region_reset_brk(h->region);
+    mem_region_sbrk(h->region, ALIGN(sizeof(mm_heap_t)));
+
+    heap = h;
+    ret = init_heap();
+    heap = old;
+    return ret;
+}
+
+/*
+ * mm_heap_destroy - release heap h and the region it lives in
+ */
+void mm_heap_destroy(mm_heap_t *h)
+{
+    if (h->side_region)
+        mem_region_destroy(h->side_region);
+    mem_region_destroy(h->region);
+}
+
+/*
+ * mm_heap_region - the region heap h lives in
+ */
+mem_region_t *mm_heap_region(mm_heap_t *h)
+{
+    return h->region;
+}
+
+/*
+ * mm_heap_malloc, mm_heap_free, mm_heap_realloc, mm_heap_calloc,
+ * mm_heap_free_batch, mm_heap_checkheap - the default heap routines,
+ * run on heap h
+ */
+void *mm_heap_malloc(mm_heap_t *h, size_t size)
+{
+    mm_heap_t *old = heap;
+    heap = h;
+    void *bp = malloc(size);
+    heap = old;
+    return bp;
+}
+
+void mm_heap_free(mm_heap_t *h, void *bp)
+{
+    mm_heap_t *old = heap;
+    heap = h;
+    free(bp);
+    heap = old;
+}
+
+void *mm_heap_realloc(mm_heap_t *h, void *oldbp, size_t size)
+{
+    mm_heap_t *old = heap;
+    heap = h;
+    void *bp = realloc(oldbp, size);
+    heap = old;
+    return bp;
+}
+
+void *mm_heap_calloc(mm_heap_t *h, size_t nmemb, size_t size)
+{
+    mm_heap_t *old = heap;
+    heap = h;
+    void *bp = calloc(nmemb, size);
+    heap = old;
+    return bp;
+}
+
+void mm_heap_free_batch(mm_heap_t *h, void **ptrs, size_t n)
+{
+    mm_heap_t *old = heap;
+    heap = h;
+    mm_free_batch(ptrs, n);
+    heap = old;
+}
+
+void mm_heap_checkheap(mm_heap_t *h, int lineno)
+{
+    mm_heap_t *old = heap;
+    heap = h;
+    mm_checkheap(lineno);
+    heap = old;
+}
+
+/*
+ * mm_heap_free_remote - free a block of heap h from a thread that may
+ * not own h: queue it, without a lock, to be freed at h's next malloc
+ */
+void mm_heap_free_remote(mm_heap_t *h, void *bp)
+{
+    unsigned int off, top;
+
+    if (bp == NULL)
+        return;
+
+    off = (unsigned int)((char *)bp - h->heap_listp);
+    do
+    {
+        top = __atomic_load_n(&h->remote, __ATOMIC_RELAXED);
+        PUT(PREDP(bp), top);
+    } while (!__sync_bool_compare_and_swap(&h->remote, top, off));
+}
+
+/*
+ * mm_size_class - the class that the block for a request of size bytes
+ * belongs to, and that block's size; for tools studying the class layout
+ */
+int mm_size_class(size_t size, size_t *block_size)
+{
+    size_t asize = adjust_size(size);
+
+    if (block_size)
+        *block_size = asize;
+    return size_class(asize);
+}
+
+/*
+ * mm_heap_walk - call fn on every block of the heap in address order,
+ * with its offset from the start of the region, its size, its alloc bit
+ * and its size class. In side table mode only the bitmaps are read.
+ */
+void mm_heap_walk(mm_walk_fn fn, void *arg)
+{
+    char *lo = mem_region_lo(heap->region);
+    char *bp;
+    unsigned int size;
+    size_t g, next, end;
+
+    if (!heap->heap_listp)
+        return;
+    if (heap->side)
+    {
+        end = SIDE_GRAN((char *)mem_region_hi(heap->region) + 1);
+        for (g = side_next(0, end); g < end; g = next)
+        {
+            next = side_next(g, end);
+            size = (next - g) * DSIZE;
+            fn(arg, heap->heap_listp + g * DSIZE - WSIZE - lo, size,
+               !!(heap->side[2 * (g >> 6) + 1] & 1UL << (g & 63)),
+               size_class(size));
+        }
+        return;
+    }
+    for (bp = NEXT_BLKP(heap->heap_listp); (size = GET_SIZE(HDRP(bp)));
+         bp = NEXT_BLKP(bp))
+        fn(arg, HDRP(bp) - lo, size, GET_ALLOC(HDRP(bp)), size_class(size));
+}
+
+/*
+ * mm_list_stats - how far the searches and ordered inserts of the heap
+ * walked its free lists since it was initialized
+ */
+void mm_list_stats(mm_list_stats_t *stats)
+{
+    stats->fits = heap->fits;
+    stats->fit_steps = heap->fit_steps;
+    stats->inserts = heap->inserts;
+    stats->insert_steps = heap->insert_steps;
+}
+
+/*
+ * Return whether the pointer is in the heap.
+ */
+static int in_heap(const void *p)
+{
+    return p <= mem_region_hi(heap->region) &&
+           p >= mem_region_lo(heap->region);
+}
+
+/*
+ * Return whether the pointer is aligned.
+ */
+static int aligned(const void *p)
+{
+    return (size_t)ALIGN(p) == (size_t)p;
+}
+
+/*
+ * mm_checkheap - check almost everything
+ */
+void mm_checkheap(int lineno)
+{
+    dbg_printf("\nin check_heap\n");
+    if (GET(heap->heap_listp - WSIZE) != PACK(DSIZE, PREV_ALLOCATED, ALLOCATED))
+    {
+        printf("Error: line %d, invalid prologue %u\n",
+               lineno, GET(heap->heap_listp - WSIZE));
+        exit(0);
+    }
+
+    char *epilogue = (char *)mem_region_hi(heap->region) - 3;
+    if ((GET(epilogue) & ~0x2) != PACK(0, PREV_FREE, ALLOCATED))
+    {
+        printf("Error: line %d, invalid epilogue %u\n", lineno, GET(epilogue));
+        exit(0);
+    }
+
+    /* check blocks one by one */
+    char *prev_bp = 0;
+    int heap_free_cnt = 0, list_free_cnt = 0;
+    for (char *bp = heap->heap_listp; bp < epilogue;
+         prev_bp = bp, bp = NEXT_BLKP(bp))
+    {
+        if (!GET_ALLOC(HDRP(bp)))
+        {
+            heap_free_cnt++;
+        }
+
+        if (!aligned(bp))
+        {
+            printf("Error: line %d, unaligned block (%u; %u)\n",
+                   lineno, A2O(HDRP(bp)),
+                   A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1));
+            print_heap();
+            exit(0);
+        }
+
+        if (!in_heap(HDRP(bp)) || !in_heap(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1))
+        {
+            printf("Error: line %d, block (%u; %u) outside heap (%u; %u)\n ",
+                   lineno,
+                   A2O(HDRP(bp)), A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1),
+                   A2O(mem_region_lo(heap->region)),
+                   A2O(mem_region_hi(heap->region)));
+            print_heap();
+            exit(0);
+        }
+
+        if (bp != heap->heap_listp && GET_SIZE(HDRP(bp)) < 2 * DSIZE)
+        {
+            printf("Error: line %d, block size too small (%u; %u)\n",
+                   lineno, A2O(HDRP(bp)),
+                   A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1));
+            print_heap();
+            exit(0);
+        }
+
+        if (prev_bp && !heap->mt &&
+            GET_ALLOC(HDRP(prev_bp)) != (GET_PREV_ALLOC(HDRP(bp)) >> 1))
+        {
+            printf("Error: line %d, inconsistent alloc bit.\n", lineno);
+            printf("Prev header %u alloc %u cur header %u prev_alloc %u\n",
+                   A2O(HDRP(prev_bp)), GET_ALLOC(HDRP(prev_bp)),
+                   A2O(HDRP(bp)), (GET_PREV_ALLOC(HDRP(bp)) >> 1));
+            print_heap();
+            exit(0);
+        }
+
+        if (!GET_ALLOC(HDRP(bp)) && GET_ALLOC(FTRP(bp)))
+        {
+            printf("Error: line %d, inconsistent alloc bit in free (%u; %u)\n",
+                   lineno, A2O(HDRP(bp)),
+                   A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1));
+            print_heap();
+            exit(0);
+        }
+
+        if (heap->mt && GET(FTRP(bp)) != GET(HDRP(bp)))
+        {
+            printf("Error: line %d, header and footer differ (%u; %u)\n",
+                   lineno, A2O(HDRP(bp)),
+                   A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1));
+            print_heap();
+            exit(0);
+        }
+
+        if (prev_bp && !heap->mt &&
+            !GET_ALLOC(HDRP(prev_bp)) && !GET_ALLOC(HDRP(bp)))
+        {
+            printf("Error: line %d, contiguous free blocks (%u; %u)\n",
+                   lineno, A2O(HDRP(bp)),
+                   A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1));
+            print_heap();
+            exit(0);
+        }
+
+        /* the side table has this block's start, alloc bit and size */
+        size_t g = SIDE_GRAN(bp);
+        if (heap->side &&
+            (!(heap->side[2 * (g >> 6)] & 1UL << (g & 63)) ||
+             !(heap->side[2 * (g >> 6) + 1] & 1UL << (g & 63)) !=
+                 !GET_ALLOC(HDRP(bp)) ||
+             side_next(g, SIDE_GRAN(epilogue + WSIZE)) !=
+                 SIDE_GRAN(NEXT_BLKP(bp))))
+        {
+            printf("Error: line %d, side table disagrees on block (%u; %u)\n",
                    lineno, A2O(HDRP(bp)),
                    A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1));
             print_heap();
@@ -530,10 +1521,19 @@ void mm_checkheap(int lineno)
     }
 
     /* check blocks in free lists */
-    for (int no = 0; no < CLASS_NUM; no++)
+    for (int no = 0; no < (int)heap->lists; no++)
     {
+        if (heap->tlsf &&
+            !GET(heap->class_head + no * WSIZE) !=
+                !(heap->sl_bitmap[no / TLSF_SL_NUM] & 1 << no % TLSF_SL_NUM))
+        {
+            printf("Error: line %d, TLSF bitmap wrong for list %d.\n",
+                   lineno, no);
+            exit(0);
+        }
+
         prev_bp = 0;
-        for (char *bp = O2A(GET(class_head + no * WSIZE)); A2O(bp);
+        for (char *bp = O2A(GET(heap->class_head + no * WSIZE)); A2O(bp);
              list_free_cnt++, prev_bp = bp, bp = SUCC_BLKP(bp))
         {
             if (prev_bp)
@@ -552,11 +1552,50 @@ void mm_checkheap(int lineno)
                 printf("Error: line %d, block (%u; %u) outside heap (%u; %u)\n",
                        lineno,
                        A2O(HDRP(bp)), A2O(HDRP(bp) + GET_SIZE(HDRP(bp)) - 1),
-                       A2O(mem_heap_lo()), A2O(mem_heap_hi()));
+                       A2O(mem_region_lo(heap->region)),
+                       A2O(mem_region_hi(heap->region)));
+                print_heap();
+                exit(0);
+            }
+
+            if (!heap->tlsf && prev_bp &&
+                GET_SIZE(HDRP(prev_bp)) > GET_SIZE(HDRP(bp)))
+            {
+                printf("Error: line %d, list %d out of order.\n", lineno, no);
                 print_heap();
                 exit(0);
             }
         }
+
+        if (!heap->tlsf &&
+            heap->class_max[no] != (prev_bp ? GET_SIZE(HDRP(prev_bp)) : 0))
+        {
+            printf("Error: line %d, class %d max %u wrong.\n", lineno, no,
+                   heap->class_max[no]);
+            print_heap();
+            exit(0);
+        }
+    }
+
+    /* check the wilderness, the one free block on no list */
+    if (heap->wild)
+    {
+        if (GET_ALLOC(HDRP(heap->wild)) ||
+            GET_SIZE(HDRP(NEXT_BLKP(heap->wild))))
+        {
+            printf("Error: line %d, wilderness (%u; %u) not a free tail.\n",
+                   lineno, A2O(HDRP(heap->wild)),
+                   A2O(HDRP(heap->wild) + GET_SIZE(HDRP(heap->wild)) - 1));
+            print_heap();
+            exit(0);
+        }
+        list_free_cnt++;
+    }
+    else if (!heap->mt && !GET_PREV_ALLOC(epilogue))
+    {
+        printf("Error: line %d, free tail is not the wilderness.\n", lineno);
+        print_heap();
+        exit(0);
     }
 
     /* check free block consistency */
@@ -567,231 +1606,1068 @@ void mm_checkheap(int lineno)
         print_heap();
         exit(0);
     }
+
+    /* check buddy free lists */
+    for (int k = 0; k < BUDDY_ORDERS; k++)
+    {
+        if (!heap->buddy_head[k] != !(heap->buddy_map & 1U << k))
+        {
+            printf("Error: line %d, buddy map wrong for order %d.\n",
+                   lineno, k + BUDDY_MIN_ORDER);
+            exit(0);
+        }
+        for (char *bp = O2A(heap->buddy_head[k]); A2O(bp);
+             bp = SUCC_BLKP(bp))
+        {
+            if ((GET(HDRP(bp)) & ~BUDDY_TAG(BUDDY_ARENAS - 1)) !=
+                ((1U << (k + BUDDY_MIN_ORDER)) | BUDDY))
+            {
+                printf("Error: line %d, bad free buddy block %u.\n",
+                       lineno, A2O(bp));
+                exit(0);
+            }
+        }
+    }
+}
+
+/**
+ * Helper routines
+ */
+/*
+ * extend_heap - extend heap by words*WSIZE bytes, set headers/footers
+ * accordingly, and coalesce the free block.
+ * returns NULL on error, (coalesced) free block ptr at success.
+ */
+static inline void *extend_heap(size_t words)
+{
+    char *bp;
+    unsigned int prev_alloc;
+    /* Allocate an even number of words to maintain alignment */
+    size_t size = size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+    if (heap->side && side_grow(size) < 0)
+        return NULL;
+    if ((long)(bp = mem_region_sbrk(heap->region, size)) == -1)
+        return NULL;
+
+    /* Initialize free block header/footer and the epilogue header */
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    PUT_HDR(bp, PACK(size, prev_alloc, FREE));
+    PUT(FTRP(bp), PACK(size, prev_alloc, FREE));
+    PUT_HDR(NEXT_BLKP(bp), PACK(0, PREV_FREE, ALLOCATED));
+
+    /* Coalesce if the previous block was free, and add it to free list */
+    return coalesce(bp);
+}
+
+/**
+ * coalesce - coalesce the prev/next blocks if possible
+ * returns (coalesced) frree block ptr.
+ * NOTES:
+ * This function is in charge of maintaining free lists.
+ */
+static inline void *coalesce(void *bp)
+{
+    size_t prev_alloc, next_alloc;
+    size_t size = GET_SIZE(HDRP(bp));
+    void *prevbp = NULL;
+
+    /* in side table mode the neighbours are looked up in the bitmaps,
+       save a block before that starts too far back */
+    if (heap->side && (prevbp = side_prev(bp)))
+        prev_alloc = side_alloc(prevbp) ? PREV_ALLOCATED : PREV_FREE;
+    else if (!(prev_alloc = GET_PREV_ALLOC(HDRP(bp))))
+        prevbp = PREV_BLKP(bp);
+    if (heap->side)
+        next_alloc = side_alloc(NEXT_BLKP(bp));
+    else
+        next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+
+    /* Case 1: previous and next blocks are allocated */
+    if (prev_alloc && next_alloc)
+    {
+        add_free_list(bp);
+        return bp;
+    }
+    /* Case 2: next block is free */
+    else if (prev_alloc && !next_alloc)
+    {
+        del_free_list(NEXT_BLKP(bp));
+        if (heap->side)
+            side_clear(NEXT_BLKP(bp));
+
+        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(bp), PACK(size, prev_alloc, FREE));
+        PUT(FTRP(bp), PACK(size, prev_alloc, FREE));
+
+        add_free_list(bp);
+    }
+    /* Case 3: previous block is free */
+    else if (!prev_alloc && next_alloc)
+    {
+        del_free_list(prevbp);
+        if (heap->side)
+            side_clear(bp);
+
+        size += GET_SIZE(HDRP(prevbp));
+        prev_alloc = GET_PREV_ALLOC(HDRP(prevbp));
+
+        PUT(FTRP(bp), PACK(size, prev_alloc, FREE));
+        PUT(HDRP(prevbp), PACK(size, prev_alloc, FREE));
+        bp = prevbp;
+
+        add_free_list(bp);
+    }
+    /* Case 4: previous and next blocks are free */
+    else
+    {
+        del_free_list(prevbp);
+        del_free_list(NEXT_BLKP(bp));
+        if (heap->side)
+        {
+            side_clear(bp);
+            side_clear(NEXT_BLKP(bp));
+        }
+
+        size += GET_SIZE(HDRP(prevbp)) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        prev_alloc = GET_PREV_ALLOC(HDRP(prevbp));
+
+        PUT(HDRP(prevbp), PACK(size, prev_alloc, FREE));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, prev_alloc, FREE));
+        bp = prevbp;
+
+        add_free_list(bp);
+    }
+
+    return bp;
+}
+
+/*
+ * get_class_ptr - get ptr to the header of the right list
+ */
+static inline void *get_class_ptr(void *bp)
+{
+    return heap->class_head + list_index(GET_SIZE(HDRP(bp))) * WSIZE;
+}
+
+/*
+ * size_class - index of the class holding blocks of size bytes, without
+ * branches: the power of two picks a group of CLASS_SUB classes, the bits
+ * below its leading one the class in the group
+ */
+static inline unsigned int size_class(unsigned int size)
+{
+    unsigned int log2 = 31 - __builtin_clz(size | 32);
+    unsigned int sub = (size >> (log2 - CLASS_SUB_BITS)) & (CLASS_SUB - 1);
+    unsigned int i = ((log2 - 5) << CLASS_SUB_BITS) + sub + 1;
+
+    i &= -(unsigned int)(size >= 32);
+    return MIN(i, CLASS_NUM - 1);
+}
+
+/*
+ * tlsf_index - index of the TLSF list holding blocks of size bytes
+ */
+static inline unsigned int tlsf_index(unsigned int size)
+{
+    unsigned int log2, fl, sl;
+
+    if (size < (1 << TLSF_FL_SHIFT))
+        return size >> (TLSF_FL_SHIFT - TLSF_SL_BITS);
+
+    log2 = 31 - __builtin_clz(size);
+    fl = log2 - TLSF_FL_SHIFT + 1;
+    sl = (size >> (log2 - TLSF_SL_BITS)) & (TLSF_SL_NUM - 1);
+    return fl * TLSF_SL_NUM + sl;
+}
+
+/*
+ * list_index - index of the free list holding blocks of size bytes
+ */
+static inline unsigned int list_index(unsigned int size)
+{
+    return heap->tlsf ? tlsf_index(size) : size_class(size);
+}
+
+/*
+ * tlsf_find - head of the first non-empty TLSF list whose blocks all
+ * hold asize bytes, found with the bitmaps
+ * returns NULL on fail, block ptr on success.
+ */
+static inline void *tlsf_find(size_t asize)
+{
+    unsigned int i, fl, sl, map;
+
+    /* round up to the start of the next list */
+    if (asize < (1 << TLSF_FL_SHIFT))
+        asize += (1 << (TLSF_FL_SHIFT - TLSF_SL_BITS)) - 1;
+    else
+        asize += (1UL << (63 - __builtin_clzl(asize) - TLSF_SL_BITS)) - 1;
+    if (asize >> 32)
+        return NULL;
+
+    i = tlsf_index(asize);
+    fl = i / TLSF_SL_NUM;
+    sl = i % TLSF_SL_NUM;
+
+    map = heap->sl_bitmap[fl] & (~0U << sl);
+    if (!map)
+    {
+        map = fl + 1 < TLSF_FL_NUM ? heap->fl_bitmap & (~0U << (fl + 1)) : 0;
+        if (!map)
+            return NULL;
+        fl = __builtin_ctz(map);
+        map = heap->sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(map);
+    return O2A(GET(heap->class_head + (fl * TLSF_SL_NUM + sl) * WSIZE));
+}
+
+/*
+ * del_free_list - delete a free block from list
+ */
+static inline void del_free_list(void *bp)
+{
+    if (bp == heap->wild)
+    {
+        heap->wild = NULL;
+        return;
+    }
+
+    void *pred_bp = PRED_BLKP(bp);
+    void *succ_bp = SUCC_BLKP(bp);
+    if (pred_bp == heap->heap_listp)
+    {
+        void *cp = get_class_ptr(bp);
+        PUT(cp, A2O(SUCC_BLKP(bp)));
+
+        /* the list is empty now: clear its bits, or its max */
+        if (!heap->tlsf && !GET(cp))
+            heap->class_max[((char *)cp - heap->class_head) / WSIZE] = 0;
+        else if (heap->tlsf && !GET(cp))
+        {
+            unsigned int i = ((char *)cp - heap->class_head) / WSIZE;
+            unsigned int fl = i / TLSF_SL_NUM;
+            heap->sl_bitmap[fl] &= ~(1U << i % TLSF_SL_NUM);
+            if (!heap->sl_bitmap[fl])
+                heap->fl_bitmap &= ~(1U << fl);
+        }
+    }
+    else
+    {
+        PUT(SUCCP(pred_bp), A2O(SUCC_BLKP(bp)));
+
+        /* the largest block goes: its predecessor is the largest now */
+        if (!heap->tlsf && succ_bp == heap->heap_listp)
+            heap->class_max[size_class(GET_SIZE(HDRP(bp)))] =
+                GET_SIZE(HDRP(pred_bp));
+    }
+    if (succ_bp != heap->heap_listp)
+    {
+        PUT(PREDP(succ_bp), A2O(PRED_BLKP(bp)));
+    }
+}
+
+/*
+ * add_free_list - insert a free block to the right ordered list, or make
+ * it the wilderness if it ends the heap
+ */
+static inline void add_free_list(void *bp)
+{
+    if (!heap->mt && !GET_SIZE(HDRP(NEXT_BLKP(bp))))
+    {
+        heap->wild = bp;
+        return;
+    }
+
+    void *cp = get_class_ptr(bp);
+
+    /* TLSF lists are unordered: push at the head and set the bits */
+    if (heap->tlsf)
+    {
+        unsigned int i = ((char *)cp - heap->class_head) / WSIZE;
+        PUT(PREDP(bp), 0);
+        PUT(SUCCP(bp), GET(cp));
+        if (GET(cp))
+            PUT(PREDP(O2A(GET(cp))), A2O(bp));
+        PUT(cp, A2O(bp));
+        heap->sl_bitmap[i / TLSF_SL_NUM] |= 1U << i % TLSF_SL_NUM;
+        heap->fl_bitmap |= 1U << i / TLSF_SL_NUM;
+        return;
+    }
+
+    /* find the first block at least as large; heap_listp stands for the
+       head, as its offset is 0 */
+    void *cur_bp = heap->heap_listp;
+    void *succ_bp = O2A(GET(cp));
+    unsigned int size = GET_SIZE(HDRP(bp));
+    heap->inserts++;
+    while (succ_bp != heap->heap_listp && GET_SIZE(HDRP(succ_bp)) < size)
+    {
+        cur_bp = succ_bp;
+        succ_bp = SUCC_BLKP(succ_bp);
+        PREFETCH(HDRP(succ_bp));
+        heap->insert_steps++;
+    }
+
+    if (cur_bp == heap->heap_listp)
+        PUT(cp, A2O(bp));
+    else
+        PUT(SUCCP(cur_bp), A2O(bp));
+    PUT(PREDP(bp), A2O(cur_bp));
+    PUT(SUCCP(bp), A2O(succ_bp));
+    if (succ_bp != heap->heap_listp)
+        PUT(PREDP(succ_bp), A2O(bp));
+    else /* the largest block of its class now */
+        heap->class_max[((char *)cp - heap->class_head) / WSIZE] = size;
+}
+
+/*
+ * fit_class - the first class from i on whose largest block holds asize
+ * bytes, found by comparing the maxima of 4 classes at once; CLASS_NUM
+ * if there is none
+ */
+static inline unsigned int fit_class(unsigned int i, size_t asize)
+{
+    unsigned int g;
+
+    if (asize > 0x7fffffff)
+        return CLASS_NUM;
+
+#ifdef __SSE2__
+    /* a signed compare does, as block sizes stay below 2^31 */
+    __m128i want = _mm_set1_epi32((int)asize - 1);
+    unsigned int mask;
+    for (g = i & ~3U; g < CLASS_GROUPS * 4; g += 4)
+    {
+        __m128i max = _mm_loadu_si128((const __m128i *)&heap->class_max[g]);
+        mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(max, want)));
+        if (g < i)
+            mask &= ~0U << (i - g);
+        if (mask)
+            return g + __builtin_ctz(mask);
+    }
+#else
+    for (g = i; g < CLASS_NUM; g++)
+        if (heap->class_max[g] >= asize)
+            return g;
+#endif
+    return CLASS_NUM;
+}
+
+/**
+ * find_fit - find a block to allocate: the first fit in the first class
+ * whose largest block fits, which is a best fit, as the lists are ordered.
+ * returns NULL on fail, block ptr on success.
+ */
+static inline void *find_fit(size_t asize)
+{
+    void *bp;
+    unsigned int i;
+
+    if (heap->tlsf)
+    {
+        bp = tlsf_find(asize);
+        return bp ? bp : wild_fit(asize);
+    }
+
+    heap->fits++;
+    i = fit_class(size_class(asize), asize);
+    if (i == CLASS_NUM)
+        return wild_fit(asize);
+
+    /* the largest block of the class fits, so the walk ends in the list */
+    bp = O2A(GET(heap->class_head + i * WSIZE));
+    PREFETCH(HDRP(SUCC_BLKP(bp)));
+    while (GET_SIZE(HDRP(bp)) < asize)
+    {
+        bp = SUCC_BLKP(bp);
+        PREFETCH(HDRP(SUCC_BLKP(bp)));
+        heap->fit_steps++;
+    }
+    return bp;
+}
+
+/*
+ * wild_fit - the wilderness, if it holds asize bytes; the last resort of
+ * a search
+ * returns NULL on fail, block ptr on success.
+ */
+static inline void *wild_fit(size_t asize)
+{
+    if (heap->wild && GET_SIZE(HDRP(heap->wild)) >= asize)
+        return heap->wild;
+    return NULL;
+}
+
+/**
+ * place - place a block, possibly splitting it. In split placement mode a
+ * block of class SPLIT_CLASS or above is carved from the high end of a
+ * listed free block, so that small blocks and large ones gather apart.
+ * The wilderness is always split at its low end, keeping its rest at the
+ * top of the heap where the next extension joins it.
+ * returns the block ptr of the placed block.
+ */
+static inline void *place(void *bp, size_t asize)
+{
+    unsigned int csize = GET_SIZE(HDRP(bp));
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    int wild = (bp == heap->wild);
+
+    del_free_list(bp);
+
+    /* need split, large block at the high end */
+    if ((csize - asize) >= (2 * DSIZE) && !wild &&
+        size_class(asize) >= heap->split)
+    {
+        void *rest = bp;
+        PUT(HDRP(rest), PACK(csize - asize, prev_alloc, FREE));
+        PUT(FTRP(rest), PACK(csize - asize, prev_alloc, FREE));
+
+        bp = NEXT_BLKP(rest);
+        PUT_HDR(bp, PACK(asize, PREV_FREE, ALLOCATED));
+
+        unsigned int next_size = GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(next_size, PREV_ALLOCATED, ALLOCATED));
+
+        add_free_list(rest);
+    }
+    /* need split, small block at the low end */
+    else if ((csize - asize) >= (2 * DSIZE))
+    {
+        PUT_HDR(bp, PACK(asize, prev_alloc, ALLOCATED));
+
+        void *rest = NEXT_BLKP(bp);
+        PUT_HDR(rest, PACK(csize - asize, PREV_ALLOCATED, FREE));
+        PUT(FTRP(rest), PACK(csize - asize, PREV_ALLOCATED, FREE));
+
+        add_free_list(rest);
+    }
+    /* should not split */
+    else
+    {
+        PUT_HDR(bp, PACK(csize, prev_alloc, ALLOCATED));
+
+        unsigned int next_size = GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(next_size, PREV_ALLOCATED, ALLOCATED));
+    }
+    return bp;
 }
 
-/**
- * Helper routines
- */
 /*
- * extend_heap - extend heap by words*WSIZE bytes, set headers/footers
- * accordingly, and coalesce the free block.
- * returns NULL on error, (coalesced) free block ptr at success.
+ * line_pad - bytes to split off the front of free block bp so that the
+ * rest starts on a cache line: none, or at least a minimum block
  */
-static inline void *extend_heap(size_t words)
+static inline size_t line_pad(void *bp)
 {
-    char *bp;
-    unsigned int prev_alloc;
-    /* Allocate an even number of words to maintain alignment */
-    size_t size = size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-    if ((long)(bp = mem_sbrk(size)) == -1)
-        return NULL;
-
-    /* Initialize free block header/footer and the epilogue header */
-    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
-    PUT(HDRP(bp), PACK(size, prev_alloc, FREE));
-    PUT(FTRP(bp), PACK(size, prev_alloc, FREE));
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, PREV_FREE, ALLOCATED));
+    size_t pad = -(size_t)bp & (heap->line - 1);
 
-    /* Coalesce if the previous block was free, and add it to free list */
-    return coalesce(bp);
+    if (pad && pad < 2 * DSIZE)
+        pad += heap->line;
+    return pad;
 }
 
-/**
- * coalesce - coalesce the prev/next blocks if possible
- * returns (coalesced) frree block ptr.
- * NOTES:
- * This function is in charge of maintaining free lists.
+/*
+ * find_line_fit - find a free block that holds asize bytes once aligned
+ * to a cache line. The lists are not ordered by that, so only the first
+ * LINE_SCAN blocks from asize's class on and the wilderness are tried;
+ * failing those, any block of fitsize bytes, enough for the worst pad,
+ * is found as usual.
+ * returns NULL on fail, block ptr on success.
  */
-static inline void *coalesce(void *bp)
+static inline void *find_line_fit(size_t asize, size_t fitsize)
 {
-    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
-    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-    size_t size = GET_SIZE(HDRP(bp));
+    void *bp;
+    unsigned int i, n = LINE_SCAN;
 
-    /* Case 1: previous and next blocks are allocated */
-    if (prev_alloc && next_alloc)
+    for (i = list_index(asize); i < heap->lists && n; i++)
     {
-        add_free_list(bp);
-        return bp;
+        bp = O2A(GET(heap->class_head + i * WSIZE));
+        for (; bp != heap->heap_listp && n; bp = SUCC_BLKP(bp), n--)
+            if (GET_SIZE(HDRP(bp)) >= line_pad(bp) + asize)
+                return bp;
     }
-    /* Case 2: next block is free */
-    else if (prev_alloc && !next_alloc)
-    {
-        del_free_list(NEXT_BLKP(bp));
+    bp = heap->wild;
+    if (bp && GET_SIZE(HDRP(bp)) >= line_pad(bp) + asize)
+        return bp;
+    return find_fit(fitsize);
+}
 
-        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(HDRP(bp), PACK(size, prev_alloc, FREE));
-        PUT(FTRP(bp), PACK(size, prev_alloc, FREE));
+/*
+ * align_line - split the front off free block bp, so that the rest starts
+ * on a cache line; the front stays free.
+ * returns the free block starting on the line.
+ */
+static inline void *align_line(void *bp)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    size_t pad = line_pad(bp);
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    void *rest;
 
-        add_free_list(bp);
-    }
-    /* Case 3: previous block is free */
-    else if (!prev_alloc && next_alloc)
-    {
-        del_free_list(PREV_BLKP(bp));
+    if (pad == 0)
+        return bp;
 
-        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        prev_alloc = GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)));
+    /* lay down the rest first, so that the front does not end the heap */
+    del_free_list(bp);
+    PUT(HDRP(bp), PACK(pad, prev_alloc, FREE));
+    PUT(FTRP(bp), PACK(pad, prev_alloc, FREE));
+    rest = (char *)bp + pad;
+    PUT_HDR(rest, PACK(csize - pad, PREV_FREE, FREE));
+    PUT(FTRP(rest), PACK(csize - pad, PREV_FREE, FREE));
+
+    add_free_list(bp);
+    add_free_list(rest);
+    return rest;
+}
 
-        PUT(FTRP(bp), PACK(size, prev_alloc, FREE));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, prev_alloc, FREE));
-        bp = PREV_BLKP(bp);
+/*
+ * buddy_fits - whether a block of asize bytes is taken from the buddy
+ * arenas: it is in their size range, and rounding it up to a power of two
+ * wastes less than 1/BUDDY_SLACK of that; else it costs more memory than
+ * the speed of the buddy system is worth
+ */
+static inline int buddy_fits(size_t asize)
+{
+    size_t pow = 2UL << (63 - __builtin_clzl(asize - 1));
 
-        add_free_list(bp);
-    }
-    /* Case 4: previous and next blocks are free */
+    return asize >= (1 << BUDDY_MIN_ORDER) &&
+           asize <= (1 << BUDDY_MAX_ORDER) &&
+           asize > pow - pow / BUDDY_SLACK;
+}
+
+/*
+ * buddy_bit - index in the free bitmap of an arena of order a of the
+ * block at offset off from its base, of size pow(2, k)
+ */
+static inline unsigned int buddy_bit(unsigned int a, size_t off,
+                                     unsigned int k)
+{
+    return (1U << (a - k)) + (unsigned int)(off >> k);
+}
+
+/*
+ * buddy_push - make the block bp of arena i a free block of order k
+ */
+static inline void buddy_push(int i, char *bp, unsigned int k)
+{
+    char *abp = heap->buddy_arena[i];
+    unsigned int *head = &heap->buddy_head[k - BUDDY_MIN_ORDER];
+    unsigned int bit = buddy_bit(heap->buddy_order[i],
+                                 HDRP(bp) - (abp + BUDDY_MAP + WSIZE), k);
+
+    PUT(HDRP(bp), (1U << k) | BUDDY_TAG(i) | BUDDY | FREE);
+    PUT(PREDP(bp), 0);
+    PUT(SUCCP(bp), *head);
+    if (*head)
+        PUT(PREDP(O2A(*head)), A2O(bp));
+    *head = A2O(bp);
+
+    heap->buddy_map |= 1U << (k - BUDDY_MIN_ORDER);
+    abp[bit >> 3] |= 1 << (bit & 7);
+}
+
+/*
+ * buddy_pop - take the free block bp of order k of arena i off its list
+ */
+static inline void buddy_pop(int i, char *bp, unsigned int k)
+{
+    char *abp = heap->buddy_arena[i];
+    unsigned int *head = &heap->buddy_head[k - BUDDY_MIN_ORDER];
+    unsigned int bit = buddy_bit(heap->buddy_order[i],
+                                 HDRP(bp) - (abp + BUDDY_MAP + WSIZE), k);
+
+    if (GET(PREDP(bp)))
+        PUT(SUCCP(PRED_BLKP(bp)), GET(SUCCP(bp)));
     else
-    {
-        del_free_list(PREV_BLKP(bp));
-        del_free_list(NEXT_BLKP(bp));
+        *head = GET(SUCCP(bp));
+    if (GET(SUCCP(bp)))
+        PUT(PREDP(SUCC_BLKP(bp)), GET(PREDP(bp)));
 
-        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        prev_alloc = GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)));
+    if (!*head)
+        heap->buddy_map &= ~(1U << (k - BUDDY_MIN_ORDER));
+    abp[bit >> 3] &= ~(1 << (bit & 7));
+}
 
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, prev_alloc, FREE));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, prev_alloc, FREE));
-        bp = PREV_BLKP(bp);
+/*
+ * buddy_malloc - allocate a block of asize bytes, rounded up to a power
+ * of two, from the buddy arenas. When no free block is large enough, a
+ * new arena is taken from the free lists, each one twice as large as
+ * the one before up to 1 MB.
+ * return NULL on error, block ptr on success.
+ */
+static inline void *buddy_malloc(size_t asize)
+{
+    unsigned int k = MAX(64 - __builtin_clzl(asize - 1), BUDDY_MIN_ORDER);
+    unsigned int a, j, map = heap->buddy_map >> (k - BUDDY_MIN_ORDER);
+    char *abp, *bp;
+    int i;
 
-        add_free_list(bp);
+    if (!map)
+    {
+        if (heap->buddy_arenas == BUDDY_ARENAS)
+            return NULL;
+        a = MIN(MAX(k, BUDDY_MIN_ORDER + 1U + heap->buddy_arenas),
+                BUDDY_MAX_ORDER);
+
+        /* the arena itself comes from the free lists */
+        heap->buddy = 0;
+        abp = malloc(BUDDY_MAP + WSIZE + (1 << a));
+        heap->buddy = 1;
+        if (abp == NULL)
+            return NULL;
+        /* that malloc gives back the remote frees first, which may have
+           released an arena, so the free slot is looked for only now */
+        for (i = 0; heap->buddy_arena[i]; i++)
+            ;
+        memset(abp, 0, BUDDY_MAP);
+        heap->buddy_arena[i] = abp;
+        heap->buddy_order[i] = a;
+        heap->buddy_arenas++;
+        buddy_push(i, abp + BUDDY_MAP + DSIZE, a);
+        map = heap->buddy_map >> (k - BUDDY_MIN_ORDER);
     }
 
+    /* take the smallest free block that fits and split it down to order
+       k, freeing the upper halves */
+    j = k + __builtin_ctz(map);
+    bp = O2A(heap->buddy_head[j - BUDDY_MIN_ORDER]);
+    i = BUDDY_ARENA(bp);
+    buddy_pop(i, bp, j);
+    while (j > k)
+    {
+        j--;
+        buddy_push(i, bp + (1 << j), j);
+    }
+
+    PUT(HDRP(bp), (1U << k) | BUDDY_TAG(i) | BUDDY | ALLOCATED);
     return bp;
 }
 
 /*
- * get_class_ptr - get ptr to the header of the right list
+ * buddy_free - free buddy block bp, merging it with its buddy as long as
+ * that is free too. An arena that becomes free as a whole goes back to
+ * the free lists.
  */
-static inline void *get_class_ptr(void *bp)
+static inline void buddy_free(void *bp)
 {
-    unsigned int size = GET_SIZE(HDRP(bp));
-    size >>= 5;
-    unsigned int i = 0;
-    while (size && i < CLASS_NUM - 1)
+    int i = BUDDY_ARENA(bp);
+    char *abp = heap->buddy_arena[i];
+    char *base = abp + BUDDY_MAP + WSIZE;
+    unsigned int a = heap->buddy_order[i];
+    size_t off = HDRP(bp) - base, boff;
+    unsigned int k = __builtin_ctz(BUDDY_SIZE(bp)), bit;
+
+    for (; k < a; k++)
+    {
+        boff = off ^ (1UL << k);
+        bit = buddy_bit(a, boff, k);
+        if (!(abp[bit >> 3] & (1 << (bit & 7))))
+            break;
+        buddy_pop(i, base + boff + WSIZE, k);
+        off &= ~(1UL << k);
+    }
+
+    if (k < a)
     {
-        ++i;
-        size >>= 1;
+        buddy_push(i, base + off + WSIZE, k);
+        return;
     }
-    return class_head + i * WSIZE;
+
+    heap->buddy_arenas--;
+    heap->buddy_arena[i] = NULL;
+    free(abp);
 }
 
 /*
- * del_free_list - delete a free block from list
+ * mt_put - write the header and footer of block bp in concurrent mode
  */
-static inline void del_free_list(void *bp)
+static inline void mt_put(char *bp, unsigned int size, unsigned int alloc)
 {
-    void *pred_bp = PRED_BLKP(bp);
-    void *succ_bp = SUCC_BLKP(bp);
-    if (pred_bp == heap_listp)
+    PUT(HDRP(bp), PACK(size, PREV_FREE, alloc));
+    PUT(HDRP(bp) + size - WSIZE, PACK(size, PREV_FREE, alloc));
+}
+
+/*
+ * mt_malloc - malloc in concurrent mode: take the first fit off the first
+ * list whose largest block holds the block, locking one list at a time,
+ * or carve it out of fresh heap under the growth lock; the rest of the
+ * block is released like a freed one.
+ * return NULL on error, block ptr on success.
+ */
+static inline void *mt_malloc(size_t size)
+{
+    size_t asize = MAX(2 * DSIZE, ALIGN(size + DSIZE));
+    unsigned int i, csize;
+    char *bp = NULL;
+
+    /* the maxima are read unlocked, so a list may not hold them by now */
+    for (i = fit_class(size_class(asize), asize); i < CLASS_NUM;
+         i = fit_class(i + 1, asize))
     {
-        void *cp = get_class_ptr(bp);
-        PUT(cp, A2O(SUCC_BLKP(bp)));
+        pthread_mutex_lock(&heap->class_lock[i]);
+        bp = O2A(GET(heap->class_head + i * WSIZE));
+        while (bp != heap->heap_listp && GET_SIZE(HDRP(bp)) < asize)
+            bp = SUCC_BLKP(bp);
+        if (bp != heap->heap_listp)
+        {
+            del_free_list(bp);
+            mt_put(bp, GET_SIZE(HDRP(bp)), ALLOCATED);
+            pthread_mutex_unlock(&heap->class_lock[i]);
+            break;
+        }
+        pthread_mutex_unlock(&heap->class_lock[i]);
+        bp = NULL;
     }
-    else
+
+    if (bp == NULL)
     {
-        PUT(SUCCP(pred_bp), A2O(SUCC_BLKP(bp)));
+        csize = MAX(asize, MT_CHUNK);
+        pthread_mutex_lock(&heap->grow_lock);
+        bp = mem_region_sbrk(heap->region, csize);
+        if (bp != (void *)-1)
+        {
+            mt_put(bp, csize, ALLOCATED);
+            PUT(HDRP(bp + csize), PACK(0, PREV_FREE, ALLOCATED));
+        }
+        pthread_mutex_unlock(&heap->grow_lock);
+        if (bp == (void *)-1)
+            return NULL;
     }
-    if (succ_bp != heap_listp)
+
+    csize = GET_SIZE(HDRP(bp));
+    if (csize - asize >= 2 * DSIZE)
     {
-        PUT(PREDP(succ_bp), A2O(PRED_BLKP(bp)));
+        mt_put(bp, asize, ALLOCATED);
+        mt_put(bp + asize, csize - asize, ALLOCATED);
+        mt_release(bp + asize);
     }
+    return bp;
 }
 
 /*
- * add_free_list - insert a free block to the right ordered list
+ * mt_release - free block bp in concurrent mode: merge it with each free
+ * neighbour whose list can be locked right away, prev first, and put it
+ * on its list
  */
-static inline void add_free_list(void *bp)
+static inline void mt_release(char *bp)
 {
-    void *cp = get_class_ptr(bp);
-    if (!GET(cp)) /* list is empty */
-    {
-        PUT(cp, A2O(bp));
-        PUT(PREDP(bp), 0);
-        PUT(SUCCP(bp), 0);
-    }
-    else
+    unsigned int size = GET_SIZE(HDRP(bp)), tag, c;
+    char *nbp;
+
+    /* the footer of the previous block: only a free one is on a list */
+    tag = GET(HDRP(bp) - WSIZE);
+    if (!(tag & ALLOCATED))
     {
-        void *cur_bp = O2A(GET(cp));
-        void *succ_bp = SUCC_BLKP(cur_bp);
-        unsigned int size = GET_SIZE(bp);
-        while (succ_bp != heap_listp && GET_SIZE(succ_bp) < size)
+        c = size_class(tag & ~0x7);
+        if (!pthread_mutex_trylock(&heap->class_lock[c]))
         {
-            cur_bp = succ_bp;
-            succ_bp = SUCC_BLKP(succ_bp);
+            if (GET(HDRP(bp) - WSIZE) == tag)
+            {
+                bp -= tag & ~0x7;
+                size += tag & ~0x7;
+                del_free_list(bp);
+                PUT(HDRP(bp), PACK(size, PREV_FREE, ALLOCATED));
+            }
+            pthread_mutex_unlock(&heap->class_lock[c]);
         }
-        PUT(SUCCP(cur_bp), A2O(bp));
-        PUT(PREDP(bp), A2O(cur_bp));
-        PUT(SUCCP(bp), A2O(succ_bp));
-        if (succ_bp != heap_listp)
+    }
+
+    /* the header of the next block; the epilogue looks allocated */
+    nbp = bp + size;
+    tag = GET(HDRP(nbp));
+    if (!(tag & ALLOCATED))
+    {
+        c = size_class(tag & ~0x7);
+        if (!pthread_mutex_trylock(&heap->class_lock[c]))
         {
-            PUT(PREDP(succ_bp), A2O(bp));
+            if (GET(HDRP(nbp)) == tag)
+            {
+                size += tag & ~0x7;
+                del_free_list(nbp);
+                PUT(HDRP(bp) + size - WSIZE, PACK(size, PREV_FREE, ALLOCATED));
+            }
+            pthread_mutex_unlock(&heap->class_lock[c]);
         }
     }
+
+    c = size_class(size);
+    pthread_mutex_lock(&heap->class_lock[c]);
+    mt_put(bp, size, FREE);
+    add_free_list(bp);
+    pthread_mutex_unlock(&heap->class_lock[c]);
 }
 
-/**
- * find_fit - find a block to allocate.
- * returns NULL on fail, block ptr on success.
+/*
+ * mt_realloc - realloc in concurrent mode: grow the block into the next
+ * one if that is free and its list not busy, or into fresh heap if the
+ * block ends the heap, else move it; what is left over is released
+ * returns NULL on error, block ptr on success.
  */
-static inline void *find_fit(size_t asize)
+static inline void *mt_realloc(void *oldbp, size_t size)
 {
-    void *cp, *bp;
-    size_t size = asize;
-    size >>= 5;
-    unsigned int i = 0;
-    while (size && i < CLASS_NUM - 1)
+    size_t asize = MAX(2 * DSIZE, ALIGN(size + DSIZE));
+    unsigned int oldsize = GET_SIZE(HDRP(oldbp)), tag, c, grow;
+    char *nbp = (char *)oldbp + oldsize;
+    void *newbp;
+
+    tag = GET(HDRP(nbp));
+    if (asize > oldsize && !(tag & ALLOCATED) &&
+        oldsize + (tag & ~0x7) >= asize)
+    {
+        c = size_class(tag & ~0x7);
+        if (!pthread_mutex_trylock(&heap->class_lock[c]))
+        {
+            if (GET(HDRP(nbp)) == tag)
+            {
+                del_free_list(nbp);
+                oldsize += tag & ~0x7;
+                mt_put(oldbp, oldsize, ALLOCATED);
+            }
+            pthread_mutex_unlock(&heap->class_lock[c]);
+        }
+    }
+    else if (asize > oldsize && !(tag & ~0x7))
     {
-        ++i;
-        size >>= 1;
+        grow = asize - oldsize;
+        pthread_mutex_lock(&heap->grow_lock);
+        if (!GET_SIZE(HDRP(nbp)) &&
+            mem_region_sbrk(heap->region, grow) != (void *)-1)
+        {
+            oldsize += grow;
+            mt_put(oldbp, oldsize, ALLOCATED);
+            PUT(HDRP((char *)oldbp + oldsize), PACK(0, PREV_FREE, ALLOCATED));
+        }
+        pthread_mutex_unlock(&heap->grow_lock);
     }
 
-    while (i < CLASS_NUM)
+    if (asize <= oldsize)
     {
-        cp = class_head + i * WSIZE; /* current class being searched */
-        if (GET(cp))
+        if (oldsize - asize >= 2 * DSIZE)
         {
-            bp = O2A(GET(cp));
-            while (bp != heap_listp && GET_SIZE(HDRP(bp)) < asize)
-            {
-                bp = SUCC_BLKP(bp);
-            }
-            if (bp != heap_listp) /* found */
-            {
-                return bp;
-            }
+            mt_put(oldbp, asize, ALLOCATED);
+            mt_put((char *)oldbp + asize, oldsize - asize, ALLOCATED);
+            mt_release((char *)oldbp + asize);
         }
-        i++;
+        return oldbp;
     }
-    return NULL;
+
+    if ((newbp = mt_malloc(size)) == NULL)
+        return 0;
+    memcpy(newbp, oldbp, MIN(size, oldsize - DSIZE));
+    mt_release(oldbp);
+    return newbp;
 }
 
-/**
- * place - place a block, possibly splitting it.
+/*
+ * grow_size - decide how many bytes to extend the heap by, given that no
+ * free block can hold asize bytes.
+ * The chunk doubles while extensions come in quick succession and halves
+ * back for every STABLE_WINDOW mallocs served without one; it never exceeds
+ * 1/CHUNKDIV of the heap, so a small heap is not swamped by a large step.
+ * If the last block is free, extend_heap coalesces it with the new area,
+ * so the shortfall is requested, rounded up to the chunk.
+ * On a region backed by huge pages the heap grows in whole huge pages.
  */
-static inline void place(void *bp, size_t asize)
+static inline size_t grow_size(size_t asize)
 {
-    unsigned int csize = GET_SIZE(HDRP(bp));
+    /* the epilogue header is the last word of the heap */
+    char *epilogue = (char *)mem_region_hi(heap->region) - (WSIZE - 1);
+    size_t size, brk, last, chunk;
 
-    del_free_list(bp);
+    if (heap->malloc_cnt < GROW_WINDOW)
+        heap->chunksize = MIN(heap->chunksize << 1, CHUNKMAX);
+    else
+        while (heap->malloc_cnt >= STABLE_WINDOW &&
+               heap->chunksize > CHUNKSIZE)
+        {
+            heap->chunksize >>= 1;
+            heap->malloc_cnt -= STABLE_WINDOW;
+        }
+    heap->malloc_cnt = 0;
+    chunk = ALIGN(MIN(heap->chunksize,
+                      mem_region_size(heap->region) / CHUNKDIV));
 
-    /* need split */
-    if ((csize - asize) >= (2 * DSIZE))
+    /* the wilderness is too small, else it would have been used: grow
+       it by the shortfall, or by the chunk if that is larger */
+    if (heap->wild)
     {
-        PUT(HDRP(bp), PACK(asize, PREV_ALLOCATED, ALLOCATED));
+        last = GET_SIZE(HDRP(heap->wild));
+        size = (last < asize) ? asize - last : 2 * DSIZE;
+        size = MAX(size, chunk);
+    }
+    else
+        size = MAX(asize, MAX(chunk, CHUNKSIZE));
 
-        bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOCATED, FREE));
-        PUT(FTRP(bp), PACK(csize - asize, PREV_ALLOCATED, FREE));
+    /* on huge pages, grow up to the next huge page boundary */
+    if (heap->hugepage)
+    {
+        brk = (size_t)epilogue + WSIZE;
+        size = ((brk + size + heap->hugepage - 1) & ~(heap->hugepage - 1)) -
+               brk;
+    }
 
-        add_free_list(bp);
+    return size;
+}
+
+/*
+ * trim_block - give the huge pages inside free block bp back to the
+ * kernel; its header, links and footer stay in place
+ */
+static inline void trim_block(void *bp)
+{
+    if (heap->hugepage && GET_SIZE(HDRP(bp)) >= heap->hugepage)
+        mem_region_trim(heap->region, SUCCP(bp) + WSIZE, FTRP(bp));
+}
+
+/*
+ * side_grow - make the side table cover the heap once it has grown by
+ * size bytes, up to and including the epilogue's granule
+ * return -1 on error, 0 on success.
+ */
+static inline int side_grow(size_t size)
+{
+    char *brk = (char *)mem_region_hi(heap->region) + 1;
+    size_t words = 2 * ((SIDE_GRAN(brk + size) >> 6) + 1);
+    unsigned long *more;
+
+    if (words <= heap->side_words)
+        return 0;
+    more = mem_region_sbrk(heap->side_region,
+                           (words - heap->side_words) * sizeof(long));
+    if (more == (void *)-1)
+        return -1;
+    memset(more, 0, (words - heap->side_words) * sizeof(long));
+    heap->side_words = words;
+    return 0;
+}
+
+/*
+ * side_mark - record in the side table that a block starts at bp, and
+ * whether it is allocated
+ */
+static inline void side_mark(void *bp, unsigned int alloc)
+{
+    size_t g = SIDE_GRAN(bp);
+    unsigned long *w = heap->side + 2 * (g >> 6), bit = 1UL << (g & 63);
+
+    w[0] |= bit;
+    w[1] = alloc ? w[1] | bit : w[1] & ~bit;
+}
+
+/*
+ * side_clear - record in the side table that no block starts at bp any
+ * more, as it was merged into the one before
+ */
+static inline void side_clear(void *bp)
+{
+    size_t g = SIDE_GRAN(bp);
+    unsigned long *w = heap->side + 2 * (g >> 6), bit = 1UL << (g & 63);
+
+    w[0] &= ~bit;
+    w[1] &= ~bit;
+}
+
+/*
+ * side_next - the granule of the first block start after granule g, or
+ * end, the epilogue's granule, if there is none before it
+ */
+static inline size_t side_next(size_t g, size_t end)
+{
+    unsigned long w;
+
+    g++;
+    w = heap->side[2 * (g >> 6)] & (~0UL << (g & 63));
+    while (!w)
+    {
+        g = (g | 63) + 1;
+        if (g >= end)
+            return end;
+        w = heap->side[2 * (g >> 6)];
     }
-    /* should not split */
-    else
+    return MIN((g & ~63UL) + __builtin_ctzl(w), end);
+}
+
+/*
+ * side_prev - the block before bp, whose start is the last one below bp's
+ * granule, if it is in the SIDE_SCAN words of starts up to bp's
+ * returns NULL if not; the prologue's, granule 0, always is a start.
+ */
+static inline void *side_prev(void *bp)
+{
+    size_t g = SIDE_GRAN(bp) - 1;
+    unsigned long w = heap->side[2 * (g >> 6)] & (~0UL >> (63 - (g & 63)));
+    int n = SIDE_SCAN;
+
+    while (!w)
     {
-        PUT(HDRP(bp), PACK(csize, PREV_ALLOCATED, ALLOCATED));
+        if (!--n)
+            return NULL;
+        g = (g & ~63UL) - 1;
+        w = heap->side[2 * (g >> 6)];
+    }
+    return heap->heap_listp +
+           ((g & ~63UL) + 63 - __builtin_clzl(w)) * DSIZE;
+}
 
-        unsigned int next_size = GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(HDRP(NEXT_BLKP(bp)), PACK(next_size, PREV_ALLOCATED, ALLOCATED));
+/*
+ * side_alloc - whether an allocated block, or the epilogue, starts at bp;
+ * 0 for any pointer off the granules the table covers
+ */
+static inline unsigned int side_alloc(void *bp)
+{
+    size_t off = (char *)bp - heap->heap_listp;
+    size_t g = off / DSIZE;
+
+    if (off % DSIZE || g >= heap->side_words * 32)
+        return 0;
+    return !!(heap->side[2 * (g >> 6) + 1] & 1UL << (g & 63));
+}
+
+/*
+ * drain_remote - take the remote free queue of the heap and free its
+ * blocks, REMOTE_BATCH at a time so that adjacent ones coalesce at once
+ */
+static inline void drain_remote(void)
+{
+    void *batch[REMOTE_BATCH];
+    unsigned int off = __sync_lock_test_and_set(&heap->remote, 0);
+    size_t n = 0;
+    char *bp;
+
+    while (off)
+    {
+        bp = O2A(off);
+        off = GET(PREDP(bp));
+        batch[n++] = bp;
+        if (n == REMOTE_BATCH)
+        {
+            mm_free_batch(batch, n);
+            n = 0;
+        }
     }
+    if (n)
+        mm_free_batch(batch, n);
+}
+
+/*
+ * adjust_size - block size for a request of size bytes,
+ * including overhead and alignment reqs.
+ */
+static inline size_t adjust_size(size_t size)
+{
+    if (size <= 3 * WSIZE)
+        return 4 * WSIZE;
+    return DSIZE * ((size + (WSIZE) + (DSIZE - 1)) / DSIZE);
+}
+
+/*
+ * addr_cmp - qsort comparator ordering block ptrs by address
+ */
+static int addr_cmp(const void *p, const void *q)
+{
+    char *a = *(char **)p, *b = *(char **)q;
+    return (a > b) - (a < b);
 }
 
 /*
@@ -801,7 +2677,8 @@ static void print_heap(void)
 {
     void *bp;
     int cnt = 0;
-    for (bp = heap_listp; bp < mem_heap_hi(); bp = NEXT_BLKP(bp), cnt++)
+    for (bp = heap->heap_listp; bp < mem_region_hi(heap->region);
+         bp = NEXT_BLKP(bp), cnt++)
     {
         printf("block %d:\t", cnt);
         printf("size %u\t", GET_SIZE(HDRP(bp)));
@@ -20,5 +20,77 @@ extern void *calloc (size_t nmemb, size_t size);
 
 extern int mm_init(void);
 
+/* Give every small block of the heaps initialized from now on a cache
+   line of its own, against false sharing between threads. */
+extern void mm_set_cacheline(int on);
+
+/* Run the heaps initialized from now on on two-level segregated fit
+   lists, for malloc and free in bounded time. */
+extern void mm_set_tlsf(int on);
+
+/* Serve blocks of 4 KB to 1 MB of the heaps initialized from now on
+   from binary buddy arenas. */
+extern void mm_set_buddy(int on);
+
+/* Carve large blocks of the heaps initialized from now on from the high
+   end of a free block and small ones from the low end. */
+extern void mm_set_split(int on);
+
+/* Keep where the blocks of the heaps initialized from now on start, and
+   which are allocated, in bitmaps outside the heap, for dense walks. */
+extern void mm_set_sidetable(int on);
+
+/* Let any number of threads use the heaps initialized from now on at
+   once, with a lock per size class and one for heap growth. */
+extern void mm_set_concurrent(int on);
+
+/* Allocate or free many blocks in one call. */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* Free a block whose payload size is known to the caller. The size is
+   only checked, in the debug build: free reads the header anyway. */
+extern void mm_free_sized(void *ptr, size_t size);
+
+/* Arenas: allocations that are all released together. */
+typedef struct mm_arena mm_arena_t;
+extern mm_arena_t *mm_arena_create(void);
+extern void *mm_arena_alloc(mm_arena_t *arena, size_t size);
+extern void mm_arena_reset(mm_arena_t *arena);
+extern void mm_arena_destroy(mm_arena_t *arena);
+
+/* Independent heaps, each in a region of its own. */
+typedef struct mm_heap mm_heap_t;
+struct mem_region;
+extern mm_heap_t *mm_heap_create(void);
+extern int mm_heap_reset(mm_heap_t *h);
+extern void mm_heap_destroy(mm_heap_t *h);
+extern struct mem_region *mm_heap_region(mm_heap_t *h);
+extern void *mm_heap_malloc(mm_heap_t *h, size_t size);
+extern void mm_heap_free(mm_heap_t *h, void *ptr);
+extern void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size);
+extern void *mm_heap_calloc(mm_heap_t *h, size_t nmemb, size_t size);
+extern void mm_heap_free_batch(mm_heap_t *h, void **ptrs, size_t n);
+extern void mm_heap_checkheap(mm_heap_t *h, int lineno);
+/* Free a block of heap h from a thread other than h's owner: it is
+   queued without a lock and freed at h's next malloc. */
+extern void mm_heap_free_remote(mm_heap_t *h, void *ptr);
+
+/* Size class and block size of a request, for trace analysis. */
+extern int mm_size_class(size_t size, size_t *block_size);
+
+/* Visit every block of the heap in address order, for heap maps. */
+typedef void (*mm_walk_fn)(void *arg, size_t offset, size_t size, int alloc,
+                           int cls);
+extern void mm_heap_walk(mm_walk_fn fn, void *arg);
+
+/* Free list walks since the heap was initialized: searches and the
+   links they followed, ordered inserts and the links they followed. */
+typedef struct {
+    unsigned long fits, fit_steps;
+    unsigned long inserts, insert_steps;
+} mm_list_stats_t;
+extern void mm_list_stats(mm_list_stats_t *stats);
+
 /* This is largely for debugging. */
 extern void mm_checkheap(int lineno);
@@ -0,0 +1,286 @@
+/*
+ * numa.c - per-NUMA-node heaps
+ *
+ * Every node owns a heap made by mm_heap_create, guarded by a lock.
+ * On a machine with several nodes the region of each heap is bound to
+ * its node with mbind; on one node, nodes are simulated by tagging the
+ * regions and spreading the CPUs over them.
+ *
+ * A thread allocates from the heap of the node it runs on. A block freed
+ * by a thread on its owning node goes straight back. A block owned by
+ * another node is parked in a per-thread buffer for that node, and the
+ * buffer is handed back in one locked mm_heap_free_batch when it fills
+ * up, on mm_numa_flush, or when the thread exits.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+#include "numa.h"
+
+#define REMOTE_BATCH 64 /* remote frees buffered per node and thread */
+
+/* One node: its heap and the lock serializing all work on it */
+typedef struct {
+    mm_heap_t *heap;
+    pthread_mutex_t lock;
+    char *lo, *hi; /* extent of the region, for ownership lookups */
+} node_t;
+
+static node_t nodes[NUMA_MAX_NODES];
+static int num_nodes = 0;
+static int simulated = 0; /* nodes are simulated, not real */
+
+/* remote frees of this thread, waiting to be handed back */
+static __thread void *pending[NUMA_MAX_NODES][REMOTE_BATCH];
+static __thread int num_pending[NUMA_MAX_NODES];
+
+/* node the calling thread was placed on, -1 to follow its CPU */
+static __thread int thread_node = -1;
+
+/* set while a thread has remote frees pending, to flush them at its exit */
+static pthread_key_t flush_key;
+static pthread_once_t flush_once = PTHREAD_ONCE_INIT;
+
+static numa_stats_t stats;
+
+/*
+ * detect_nodes - count the NUMA nodes of the machine
+ */
+static int detect_nodes(void)
+{
+    char path[64];
+    int n = 0;
+
+    while (n < NUMA_MAX_NODES)
+    {
+        sprintf(path, "/sys/devices/system/node/node%d", n);
+        if (access(path, F_OK))
+            break;
+        n++;
+    }
+    return n ? n : 1;
+}
+
+/*
+ * flush_at_exit - key destructor: hand back the remote frees a thread
+ * left pending
+ */
+static void flush_at_exit(void *arg)
+{
+    mm_numa_flush();
+}
+
+/*
+ * make_flush_key - create the key whose destructor flushes at thread exit
+ */
+static void make_flush_key(void)
+{
+    pthread_key_create(&flush_key, flush_at_exit);
+}
+
+/*
+ * destroy_nodes - release the heaps and locks of nodes 0 to n - 1
+ */
+static void destroy_nodes(int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        mm_heap_destroy(nodes[i].heap);
+        pthread_mutex_destroy(&nodes[i].lock);
+    }
+}
+
+/*
+ * mm_numa_init - create one heap per node
+ * returns -1 on error, leaving no node behind, the number of nodes on
+ * success.
+ */
+int mm_numa_init(int n)
+{
+    int real = detect_nodes();
+    int want = (n > 0) ? n : real;
+    int i;
+
+    simulated = (n > 0 && n != real) || real == 1;
+    num_nodes = 0;
+    if (want > NUMA_MAX_NODES)
+        return -1;
+    pthread_once(&flush_once, make_flush_key);
+
+    memset(&stats, 0, sizeof(stats));
+    for (i = 0; i < want; i++)
+    {
+        if ((nodes[i].heap = mm_heap_create()) == NULL)
+        {
+            destroy_nodes(i);
+            return -1;
+        }
+        if (!simulated &&
+            mem_region_bind(mm_heap_region(nodes[i].heap), i) < 0)
+        {
+            mm_heap_destroy(nodes[i].heap);
+            destroy_nodes(i);
+            return -1;
+        }
+        pthread_mutex_init(&nodes[i].lock, NULL);
+        nodes[i].lo = mem_region_lo(mm_heap_region(nodes[i].heap));
+        nodes[i].hi = nodes[i].lo + MAX_HEAP;
+    }
+    num_nodes = want;
+    return num_nodes;
+}
+
+/*
+ * mm_numa_deinit - release the heaps of all nodes
+ */
+void mm_numa_deinit(void)
+{
+    destroy_nodes(num_nodes);
+    num_nodes = 0;
+}
+
+/*
+ * mm_numa_set_node - place the calling thread on node, or let it follow
+ * the CPU it runs on if node is -1
+ */
+void mm_numa_set_node(int node)
+{
+    thread_node = node;
+}
+
+/*
+ * mm_numa_this_node - node of the calling thread
+ */
+int mm_numa_this_node(void)
+{
+    unsigned int cpu, node;
+
+    if (thread_node >= 0)
+        return thread_node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL))
+        return 0;
+    return simulated ? (int)(cpu % num_nodes) : (int)node;
+}
+
+/*
+ * mm_numa_node_of - node owning block ptr, -1 if none
+ */
+int mm_numa_node_of(void *ptr)
+{
+    for (int i = 0; i < num_nodes; i++)
+        if ((char *)ptr >= nodes[i].lo && (char *)ptr < nodes[i].hi)
+            return i;
+    return -1;
+}
+
+/*
+ * mm_numa_malloc - allocate from the heap of the calling thread's node
+ */
+void *mm_numa_malloc(size_t size)
+{
+    node_t *node = &nodes[mm_numa_this_node()];
+    void *bp;
+
+    pthread_mutex_lock(&node->lock);
+    bp = mm_heap_malloc(node->heap, size);
+    pthread_mutex_unlock(&node->lock);
+    return bp;
+}
+
+/*
+ * flush_node - hand the pending remote frees for node i back to it
+ */
+static void flush_node(int i)
+{
+    if (!num_pending[i])
+        return;
+
+    pthread_mutex_lock(&nodes[i].lock);
+    mm_heap_free_batch(nodes[i].heap, pending[i], num_pending[i]);
+    pthread_mutex_unlock(&nodes[i].lock);
+
+    num_pending[i] = 0;
+    __sync_fetch_and_add(&stats.remote_flushes, 1);
+}
+
+/*
+ * mm_numa_free - free a block, right away if the calling thread is on
+ * the owning node, else in a later batch; a ptr no node owns is ignored
+ */
+void mm_numa_free(void *ptr)
+{
+    int owner, me;
+
+    if (!ptr)
+        return;
+
+    owner = mm_numa_node_of(ptr);
+    if (owner < 0)
+        return;
+    me = mm_numa_this_node();
+    if (owner == me)
+    {
+        pthread_mutex_lock(&nodes[owner].lock);
+        mm_heap_free(nodes[owner].heap, ptr);
+        pthread_mutex_unlock(&nodes[owner].lock);
+        __sync_fetch_and_add(&stats.local_frees, 1);
+        return;
+    }
+
+    if (!num_pending[owner])
+        pthread_setspecific(flush_key, (void *)1);
+    pending[owner][num_pending[owner]++] = ptr;
+    __sync_fetch_and_add(&stats.remote_frees, 1);
+    if (num_pending[owner] == REMOTE_BATCH)
+        flush_node(owner);
+}
+
+/*
+ * mm_numa_realloc - realloc in the heap owning ptr
+ * return NULL if no node owns ptr.
+ */
+void *mm_numa_realloc(void *ptr, size_t size)
+{
+    node_t *node;
+    void *bp;
+    int owner;
+
+    if (ptr == NULL)
+        return mm_numa_malloc(size);
+    if (size == 0)
+    {
+        mm_numa_free(ptr);
+        return NULL;
+    }
+
+    if ((owner = mm_numa_node_of(ptr)) < 0)
+        return NULL;
+    node = &nodes[owner];
+    pthread_mutex_lock(&node->lock);
+    bp = mm_heap_realloc(node->heap, ptr, size);
+    pthread_mutex_unlock(&node->lock);
+    return bp;
+}
+
+/*
+ * mm_numa_flush - hand all pending remote frees of this thread back
+ */
+void mm_numa_flush(void)
+{
+    for (int i = 0; i < num_nodes; i++)
+        flush_node(i);
+}
+
+/*
+ * mm_numa_stats - read the free counters
+ */
+void mm_numa_stats(numa_stats_t *s)
+{
+    *s = stats;
+}
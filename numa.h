@@ -0,0 +1,33 @@
+/*
+ * numa.h - per-NUMA-node heaps on top of mm_heap_t
+ */
+#include <stddef.h>
+
+#define NUMA_MAX_NODES 16 /* most nodes a machine may have */
+
+/* Counters of where blocks were freed from */
+typedef struct {
+    unsigned long local_frees;   /* freed by a thread on the owning node */
+    unsigned long remote_frees;  /* freed by a thread on another node */
+    unsigned long remote_flushes;/* batches handed back to owning nodes */
+} numa_stats_t;
+
+/* Create one heap per node: nodes <= 0 detects the nodes of the machine,
+   otherwise that many nodes are simulated. Returns the number of nodes,
+   or -1 on error. */
+int mm_numa_init(int nodes);
+void mm_numa_deinit(void);
+
+void *mm_numa_malloc(size_t size);
+void mm_numa_free(void *ptr);
+void *mm_numa_realloc(void *ptr, size_t size);
+
+/* Hand this thread's pending remote frees back to their nodes; done
+   at thread exit as well. */
+void mm_numa_flush(void);
+
+/* Place the calling thread on a node; -1 follows the CPU it runs on. */
+void mm_numa_set_node(int node);
+int mm_numa_this_node(void);
+int mm_numa_node_of(void *ptr);
+void mm_numa_stats(numa_stats_t *stats);
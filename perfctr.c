@@ -0,0 +1,108 @@
+/*
+ * perfctr.c - hardware event counters of the calling thread
+ *
+ * A thin layer over perf_event_open(2). Only user space is counted, so
+ * that the counts reflect the allocator and not page fault handling.
+ * When there are more counters than the PMU has, the kernel multiplexes
+ * them; every count is then scaled up by the time its counter was
+ * enabled over the time it actually ran, so that counts of different
+ * events cover the same run and their ratios stay meaningful.
+ */
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+/* the perf_event_attr type and config of each event */
+static const struct {
+    unsigned int type;
+    unsigned long long config;
+} events[PC_NUM_EVENTS] = {
+    [PC_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PC_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [PC_CACHE_MISS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    [PC_BRANCH_MISS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [PC_DTLB_MISS] = {PERF_TYPE_HW_CACHE,
+                      PERF_COUNT_HW_CACHE_DTLB |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+/*
+ * pc_open - open a stopped counter for event
+ */
+int pc_open(pc_event_t event)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[event].type;
+    attr.config = events[event].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * pc_start - reset and start a counter
+ */
+void pc_start(int fd)
+{
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+/*
+ * pc_stop - stop a counter and read it, scaled to the whole time it was
+ * enabled if it was multiplexed; -1 if it never ran
+ */
+long long pc_stop(int fd)
+{
+    unsigned long long val[3]; /* count, time enabled, time running */
+
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, val, sizeof(val)) != sizeof(val) || val[2] == 0)
+        return -1;
+    if (val[2] < val[1])
+        return (long long)((double)val[0] * val[1] / val[2]);
+    return val[0];
+}
+
+/*
+ * pc_close - release a counter
+ */
+void pc_close(int fd)
+{
+    close(fd);
+}
+
+/*
+ * pc_measure - count all events over one run of f(argp)
+ */
+void pc_measure(pc_test_funct f, void *argp, long long counts[PC_NUM_EVENTS])
+{
+    int fds[PC_NUM_EVENTS];
+    int i;
+
+    for (i = 0; i < PC_NUM_EVENTS; i++)
+        fds[i] = pc_open(i);
+
+    for (i = 0; i < PC_NUM_EVENTS; i++)
+        if (fds[i] >= 0)
+            pc_start(fds[i]);
+    f(argp);
+    for (i = 0; i < PC_NUM_EVENTS; i++)
+        counts[i] = (fds[i] >= 0) ? pc_stop(fds[i]) : -1;
+
+    for (i = 0; i < PC_NUM_EVENTS; i++)
+        if (fds[i] >= 0)
+            pc_close(fds[i]);
+}
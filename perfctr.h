@@ -0,0 +1,30 @@
+/* Routines for hardware event counters, using perf_event_open(2) */
+
+/* Events that can be counted */
+typedef enum {
+    PC_CYCLES,       /* cpu cycles */
+    PC_INSTRUCTIONS, /* instructions retired */
+    PC_CACHE_MISS,   /* last level cache misses */
+    PC_BRANCH_MISS,  /* mispredicted branches */
+    PC_DTLB_MISS,    /* dTLB load misses */
+    PC_NUM_EVENTS
+} pc_event_t;
+
+typedef void (*pc_test_funct)(void *);
+
+/* Open a counter for an event of the calling thread, stopped.
+   Returns -1 if the event cannot be counted on this machine. */
+int pc_open(pc_event_t event);
+
+/* Reset and start the counter */
+void pc_start(int fd);
+
+/* Stop the counter and return the count since pc_start, scaled up if
+   the counter was multiplexed; -1 if it never got to run */
+long long pc_stop(int fd);
+
+void pc_close(int fd);
+
+/* Run f(argp) once and store the count of every event in counts,
+   -1 for those that cannot be counted on this machine */
+void pc_measure(pc_test_funct f, void *argp, long long counts[PC_NUM_EVENTS]);
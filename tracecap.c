@@ -0,0 +1,306 @@
+/*
+ * tracecap.c - LD_PRELOAD recorder of malloc/free/realloc/calloc calls
+ *
+ *     LD_PRELOAD=./libtracecap.so TRACECAP_FILE=out.bin ./program
+ *     ./tracerep out.bin > traces/program.rep
+ *
+ * Every thread appends records to a buffer of its own, without locks.
+ * A full buffer is pushed on a lock-free stack and replaced by a fresh
+ * one; a background thread takes the whole stack every millisecond and
+ * writes it out. Records are ordered by a global sequence number, the
+ * only write the threads share. Buffers come from mmap, so recording
+ * never calls into the allocator it records.
+ *
+ * The partial buffer of a thread is handed over when the thread exits
+ * and, for the thread that calls exit, at exit. Threads still running
+ * at exit lose the records in their partial buffers.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "tracecap.h"
+
+#define BUF_RECORDS 4096          /* records per buffer */
+#define BOOT_SIZE   (1 << 14)     /* memory served while dlsym runs */
+
+/* a buffer of records, linked into the stack of full buffers */
+typedef struct tc_buf {
+    struct tc_buf *next;
+    int n;
+    tc_record_t recs[BUF_RECORDS];
+} tc_buf_t;
+
+/* the real allocator */
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+
+/* bump allocator for calls made by dlsym before the real ones are known */
+static char boot[BOOT_SIZE];
+static size_t boot_used = 0;
+
+static uint64_t seq = 0;           /* next sequence number */
+static tc_buf_t *full = NULL;      /* buffers waiting to be written */
+static int out_fd = -1;
+static volatile int running = 0;   /* the writer is running */
+static pthread_t writer;
+static pthread_key_t buf_key;      /* hands a buffer over at thread exit */
+
+static __thread tc_buf_t *buf;     /* this thread's buffer */
+static __thread int in_hook;       /* this thread is inside a hook */
+
+/*
+ * new_buf - a fresh buffer, or NULL if out of memory
+ */
+static tc_buf_t *new_buf(void)
+{
+    tc_buf_t *b = mmap(NULL, sizeof(tc_buf_t), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED)
+        return NULL;
+    b->n = 0;
+    return b;
+}
+
+/*
+ * hand_over - push a buffer on the stack of full buffers
+ */
+static void hand_over(tc_buf_t *b)
+{
+    tc_buf_t *head;
+
+    do {
+        head = __atomic_load_n(&full, __ATOMIC_RELAXED);
+        b->next = head;
+    } while (!__atomic_compare_exchange_n(&full, &head, b, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * write_all - write out and release the buffers on the stack, oldest
+ *     first so that the file stays nearly in sequence order
+ */
+static void write_all(void)
+{
+    tc_buf_t *b = __atomic_exchange_n(&full, NULL, __ATOMIC_ACQUIRE);
+    tc_buf_t *rev = NULL, *next;
+
+    for (; b; b = next) {
+        next = b->next;
+        b->next = rev;
+        rev = b;
+    }
+    for (b = rev; b; b = next) {
+        next = b->next;
+        if (write(out_fd, b->recs, b->n * sizeof(tc_record_t)) < 0)
+            perror("tracecap: write");
+        munmap(b, sizeof(tc_buf_t));
+    }
+}
+
+/*
+ * writer_main - body of the background writer
+ */
+static void *writer_main(void *arg)
+{
+    struct timespec ms = {0, 1000000};
+
+    in_hook = 1; /* never record the writer */
+    while (running) {
+        write_all();
+        nanosleep(&ms, NULL);
+    }
+    write_all();
+    return NULL;
+}
+
+/*
+ * thread_exit - pthread key destructor: hand over a partial buffer
+ */
+static void thread_exit(void *b)
+{
+    if (b && ((tc_buf_t *)b)->n)
+        hand_over(b);
+    else if (b)
+        munmap(b, sizeof(tc_buf_t));
+    buf = NULL;
+}
+
+/*
+ * record - append one record to this thread's buffer
+ */
+static void record(uint64_t s, uint32_t type, void *ptr, void *old,
+                   size_t size)
+{
+    tc_record_t *r;
+
+    if (buf == NULL) {
+        if ((buf = new_buf()) == NULL)
+            return;
+        pthread_setspecific(buf_key, buf);
+    }
+
+    r = &buf->recs[buf->n++];
+    r->seq = s;
+    r->type = type;
+    r->ptr = (uint64_t)ptr;
+    r->old = (uint64_t)old;
+    r->size = (size < TC_SIZE_MAX) ? (uint32_t)size : TC_SIZE_MAX;
+
+    if (buf->n == BUF_RECORDS) {
+        hand_over(buf);
+        buf = new_buf();
+        pthread_setspecific(buf_key, buf);
+    }
+}
+
+#define NEXT_SEQ() __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED)
+
+/*
+ * tc_init - find the real allocator, open the output, start the writer
+ */
+__attribute__((constructor)) static void tc_init(void)
+{
+    char name[64];
+    const char *file = getenv("TRACECAP_FILE");
+
+    in_hook = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+
+    if (file == NULL) {
+        snprintf(name, sizeof(name), "tracecap.%d.bin", (int)getpid());
+        file = name;
+    }
+    out_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        perror("tracecap: open");
+    } else {
+        pthread_key_create(&buf_key, thread_exit);
+        running = 1;
+        if (pthread_create(&writer, NULL, writer_main, NULL))
+            running = 0;
+    }
+    in_hook = 0;
+}
+
+/*
+ * tc_fini - hand over the exiting thread's buffer and drain the writer
+ */
+__attribute__((destructor)) static void tc_fini(void)
+{
+    if (!running)
+        return;
+    in_hook = 1;
+    if (buf && buf->n) {
+        hand_over(buf);
+        buf = NULL;
+    }
+    running = 0;
+    pthread_join(writer, NULL);
+    close(out_fd);
+}
+
+/*
+ * boot_alloc - serve the allocations of dlsym itself
+ */
+static void *boot_alloc(size_t size)
+{
+    void *p = boot + boot_used;
+
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_SIZE)
+        return NULL;
+    boot_used += size;
+    return p;
+}
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define IN_BOOT(p) ((char *)(p) >= boot && (char *)(p) < boot + BOOT_SIZE)
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL)
+        return boot_alloc(size);
+    p = real_malloc(size);
+    if (running && !in_hook) {
+        in_hook = 1;
+        record(NEXT_SEQ(), TC_MALLOC, p, NULL, size);
+        in_hook = 0;
+    }
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || IN_BOOT(ptr))
+        return;
+    if (running && !in_hook) {
+        in_hook = 1;
+        record(NEXT_SEQ(), TC_FREE, ptr, NULL, 0);
+        in_hook = 0;
+    }
+    real_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+    uint64_t s = 0, s2;
+    int rec;
+
+    if (real_realloc == NULL || IN_BOOT(ptr)) {
+        p = malloc(size);
+        if (p && ptr) /* the old size is unknown: stay within boot */
+            memcpy(p, ptr, MIN(size, (size_t)(boot + BOOT_SIZE - (char *)ptr)));
+        return p;
+    }
+    /* the call may release ptr for another thread to get, so its number
+       is taken first; a block the call hands out needs one after it */
+    rec = running && !in_hook;
+    if (rec && ptr)
+        s = NEXT_SEQ();
+    p = real_realloc(ptr, size);
+    if (rec) {
+        in_hook = 1;
+        if (ptr == NULL) {
+            record(NEXT_SEQ(), TC_REALLOC, p, NULL, size);
+        } else if (p == NULL || p == ptr) {
+            record(s, TC_REALLOC, p, ptr, size);
+        } else {
+            s2 = NEXT_SEQ();
+            record(s, TC_MOVE, (void *)s2, ptr, 0);
+            record(s2, TC_REALLOC, p, ptr, size);
+        }
+        in_hook = 0;
+    }
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL)
+        return boot_alloc(nmemb * size); /* static memory is zeroed */
+    p = real_calloc(nmemb, size);
+    if (running && !in_hook) {
+        in_hook = 1;
+        record(NEXT_SEQ(), TC_CALLOC, p, NULL, nmemb * size);
+        in_hook = 0;
+    }
+    return p;
+}
@@ -0,0 +1,30 @@
+/*
+ * tracecap.h - records written by the libtracecap.so recorder and read
+ *              by tracerep
+ */
+#include <stdint.h>
+
+/* kinds of record */
+#define TC_MALLOC  1
+#define TC_FREE    2
+#define TC_REALLOC 3
+#define TC_CALLOC  4
+#define TC_MOVE    5 /* first half of a realloc that moved the block */
+
+/* size recorded for a request of 4 GB or more, which tracerep drops */
+#define TC_SIZE_MAX UINT32_MAX
+
+/* One call. seq orders the calls of all threads: a free takes its
+   number before the block is released, a malloc or calloc after the
+   block is obtained, so a reuse of an address never precedes its free.
+   A realloc takes its number before the call; if the block moved, that
+   number goes to a TC_MOVE record for the old block, and the TC_REALLOC
+   record takes a second number after the call. */
+typedef struct {
+    uint64_t seq;
+    uint64_t ptr;    /* block returned, or freed by TC_FREE; for TC_MOVE,
+                        the seq of the TC_REALLOC that completes it */
+    uint64_t old;    /* block passed to TC_REALLOC or TC_MOVE */
+    uint32_t size;   /* bytes requested (nmemb * size for TC_CALLOC) */
+    uint32_t type;
+} tc_record_t;
@@ -0,0 +1,400 @@
+/*
+ * traceinfo.c - describe the allocation pattern of traces
+ *
+ * usage: traceinfo [-h] [-s] [<trace> ...]
+ *
+ * For each trace (by default every .rep file in ./traces/), prints:
+ *   - the peak live payload, the footprint an ideal allocator needs;
+ *   - per size class of mm.c (from mm_size_class): the block sizes that
+ *     fell in it, the number and share of allocations, the peak of its
+ *     live payload and the median lifetime of its blocks;
+ *   - the distribution of lifetimes, in ops from allocation to free;
+ *   - the distribution of realloc growth ratios, new size / old size.
+ * A summary over all traces follows; -s prints only the summary.
+ */
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+
+#define MAXLINE      1024 /* max string size */
+#define MAX_CLASSES  128  /* more than mm.c will ever have */
+#define LIFE_BUCKETS 40   /* lifetimes in powers of two of ops */
+#define TRACEDIR     "./traces/"
+
+/* realloc growth ratios are counted in these buckets */
+#define NUM_RATIOS 8
+static const double ratio_hi[NUM_RATIOS] = {
+    0.5, 1.0, 1.0, 1.25, 1.5, 2.0, 4.0, 1e300
+};
+static const char *ratio_names[NUM_RATIOS] = {
+    "<0.5", "0.5-1", "=1", "1-1.25", "1.25-1.5", "1.5-2", "2-4", ">=4"
+};
+
+/* what is known of one size class */
+typedef struct {
+    unsigned long placed;             /* blocks placed in the class, by
+                                         allocation or realloc */
+    size_t min_block, max_block;      /* block sizes seen */
+    size_t live, peak;                /* live payload bytes in the class */
+    unsigned long life[LIFE_BUCKETS]; /* lifetimes of its freed blocks */
+} class_info_t;
+
+/* what is known of one trace, or of all of them */
+typedef struct {
+    unsigned long ops, allocs, reallocs;
+    unsigned long placed;             /* placements in all classes */
+    size_t live, peak;                /* live payload bytes */
+    unsigned long life[LIFE_BUCKETS]; /* lifetimes of freed blocks */
+    unsigned long never_freed;
+    unsigned long ratios[NUM_RATIOS];
+    class_info_t classes[MAX_CLASSES];
+} info_t;
+
+/* one live block of the trace being read */
+typedef struct {
+    size_t size;                      /* payload size, 0 if not live */
+    unsigned long born;               /* op that allocated it */
+    int cls;
+} block_t;
+
+static void app_error(const char *fmt, const char *arg);
+
+/*
+ * life_bucket - bucket of a lifetime: k such that 2^k <= life < 2^(k+1)
+ */
+static int life_bucket(unsigned long life)
+{
+    int k = 0;
+
+    while (life > 1 && k < LIFE_BUCKETS - 1) {
+        life >>= 1;
+        k++;
+    }
+    return k;
+}
+
+/*
+ * born - block b gets size bytes at op
+ */
+static void born(info_t *info, block_t *b, size_t size, unsigned long op)
+{
+    size_t bsize;
+    class_info_t *c;
+
+    b->cls = mm_size_class(size, &bsize);
+    b->size = size ? size : 1; /* a live block is never 0 bytes here */
+    b->born = op;
+
+    c = &info->classes[b->cls];
+    if (c->placed == 0 || bsize < c->min_block)
+        c->min_block = bsize;
+    if (bsize > c->max_block)
+        c->max_block = bsize;
+    c->placed++;
+    info->placed++;
+
+    c->live += b->size;
+    if (c->live > c->peak)
+        c->peak = c->live;
+    info->live += b->size;
+    if (info->live > info->peak)
+        info->peak = info->live;
+}
+
+/*
+ * died - block b is freed at op; dead is 0 if it lives on resized
+ */
+static void died(info_t *info, block_t *b, unsigned long op, int dead)
+{
+    class_info_t *c = &info->classes[b->cls];
+
+    if (b->size == 0)
+        return;
+    c->live -= b->size;
+    info->live -= b->size;
+    if (dead) {
+        c->life[life_bucket(op - b->born)]++;
+        info->life[life_bucket(op - b->born)]++;
+    }
+    b->size = 0;
+}
+
+/*
+ * analyze - read one trace into info
+ */
+static void analyze(const char *path, info_t *info)
+{
+    FILE *f;
+    char type[MAXLINE];
+    int weight, num_ids, num_ops, ignore, r;
+    unsigned int id, size = 0, count, arena, k, i;
+    block_t *blocks;
+    double ratio;
+
+    if ((f = fopen(path, "r")) == NULL)
+        app_error("cannot open %s", path);
+    if (fscanf(f, "%d %d %d %d", &weight, &num_ids, &num_ops, &ignore) != 4)
+        app_error("bad header in %s", path);
+    if ((blocks = calloc(num_ids + 1, sizeof(block_t))) == NULL)
+        app_error("out of memory reading %s", path);
+
+    /* like read_trace, stop after the num_ops requests of the header */
+    memset(info, 0, sizeof(*info));
+    while (info->ops < (unsigned long)num_ops && fscanf(f, "%s", type) != EOF) {
+        /* like mdriver, a missing size repeats the last one */
+        switch (type[0]) {
+        case 'a':
+            r = fscanf(f, "%u %u", &id, &size);
+            if (r < 1 || id >= (unsigned)num_ids)
+                app_error("bad request in %s", path);
+            died(info, &blocks[id], info->ops, 1);
+            born(info, &blocks[id], size, info->ops);
+            info->allocs++;
+            break;
+        case 'r':
+            r = fscanf(f, "%u %u", &id, &size);
+            if (r < 1 || id >= (unsigned)num_ids)
+                app_error("bad request in %s", path);
+            if (blocks[id].size) {
+                ratio = (double)size / blocks[id].size;
+                for (k = 0; k < NUM_RATIOS - 1; k++)
+                    if (ratio < ratio_hi[k] ||
+                        (ratio == 1.0 && ratio_hi[k] == 1.0 && k == 2))
+                        break;
+                info->ratios[k]++;
+                info->reallocs++;
+                /* the block keeps its birth, but may change class */
+                unsigned long b = blocks[id].born;
+                died(info, &blocks[id], info->ops, 0);
+                born(info, &blocks[id], size, info->ops);
+                blocks[id].born = b;
+            } else {
+                born(info, &blocks[id], size, info->ops);
+                info->allocs++;
+            }
+            break;
+        case 'f':
+            if (fscanf(f, "%d", (int *)&id) != 1)
+                app_error("bad request in %s", path);
+            if ((int)id >= 0 && id < (unsigned)num_ids)
+                died(info, &blocks[id], info->ops, 1);
+            break;
+        case 'A':
+            if (fscanf(f, "%u %u %u", &id, &count, &size) != 3 ||
+                id + count > (unsigned)num_ids)
+                app_error("bad request in %s", path);
+            for (i = id; i < id + count; i++)
+                born(info, &blocks[i], size, info->ops);
+            info->allocs += count;
+            break;
+        case 'F':
+            if (fscanf(f, "%u %u", &id, &count) != 2 ||
+                id + count > (unsigned)num_ids)
+                app_error("bad request in %s", path);
+            for (i = id; i < id + count; i++)
+                died(info, &blocks[i], info->ops, 1);
+            break;
+        case 'x':
+            if (fscanf(f, "%u %u %u", &arena, &id, &size) != 3 ||
+                id >= (unsigned)num_ids)
+                app_error("bad request in %s", path);
+            born(info, &blocks[id], size, info->ops);
+            info->allocs++;
+            break;
+        case 'X':
+            if (fscanf(f, "%u %u %u", &arena, &id, &count) != 3 ||
+                id + count > (unsigned)num_ids)
+                app_error("bad request in %s", path);
+            for (i = id; i < id + count; i++)
+                died(info, &blocks[i], info->ops, 1);
+            break;
+        default:
+            app_error("unknown request in %s", path);
+        }
+        info->ops++;
+    }
+
+    for (i = 0; i < (unsigned)num_ids; i++)
+        if (blocks[i].size)
+            info->never_freed++;
+
+    free(blocks);
+    fclose(f);
+}
+
+/*
+ * merge - add the counts of info to sum; peaks are the largest of any
+ *     one trace
+ */
+static void merge(info_t *sum, const info_t *info)
+{
+    int c, k;
+
+    sum->ops += info->ops;
+    sum->allocs += info->allocs;
+    sum->reallocs += info->reallocs;
+    sum->placed += info->placed;
+    sum->never_freed += info->never_freed;
+    if (info->peak > sum->peak)
+        sum->peak = info->peak;
+    for (k = 0; k < LIFE_BUCKETS; k++)
+        sum->life[k] += info->life[k];
+    for (k = 0; k < NUM_RATIOS; k++)
+        sum->ratios[k] += info->ratios[k];
+
+    for (c = 0; c < MAX_CLASSES; c++) {
+        class_info_t *s = &sum->classes[c];
+        const class_info_t *i = &info->classes[c];
+
+        if (i->placed == 0)
+            continue;
+        if (s->placed == 0 || i->min_block < s->min_block)
+            s->min_block = i->min_block;
+        if (i->max_block > s->max_block)
+            s->max_block = i->max_block;
+        s->placed += i->placed;
+        if (i->peak > s->peak)
+            s->peak = i->peak;
+        for (k = 0; k < LIFE_BUCKETS; k++)
+            s->life[k] += i->life[k];
+    }
+}
+
+/*
+ * median_life - lower end of the lifetime bucket holding the median,
+ *     0 if no block was freed
+ */
+static unsigned long median_life(const unsigned long *life)
+{
+    unsigned long total = 0, seen = 0;
+    int k;
+
+    for (k = 0; k < LIFE_BUCKETS; k++)
+        total += life[k];
+    for (k = 0; k < LIFE_BUCKETS; k++) {
+        seen += life[k];
+        if (total && 2 * seen >= total)
+            return 1UL << k;
+    }
+    return 0;
+}
+
+/*
+ * print_info - the report for one trace, or for the sum
+ */
+static void print_info(const char *name, const info_t *info)
+{
+    unsigned long freed = 0, last = 0;
+    int c, k;
+
+    printf("%s: %lu ops, %lu allocations, %lu reallocs, peak live %lu bytes\n",
+           name, info->ops, info->allocs, info->reallocs,
+           (unsigned long)info->peak);
+
+    printf("  %5s %15s %10s %6s %12s %10s\n", "class", "block sizes",
+           "placed", "%", "peak live", "med. life");
+    for (c = 0; c < MAX_CLASSES; c++) {
+        const class_info_t *ci = &info->classes[c];
+        char range[32];
+
+        if (ci->placed == 0)
+            continue;
+        snprintf(range, sizeof(range), "%lu-%lu",
+                 (unsigned long)ci->min_block, (unsigned long)ci->max_block);
+        printf("  %5d %15s %10lu %6.1f %12lu", c, range, ci->placed,
+               100.0 * ci->placed / info->placed, (unsigned long)ci->peak);
+        if (median_life(ci->life))
+            printf(" %10lu\n", median_life(ci->life));
+        else
+            printf(" %10s\n", "-");
+    }
+
+    for (k = 0; k < LIFE_BUCKETS; k++) {
+        freed += info->life[k];
+        if (info->life[k])
+            last = k;
+    }
+    printf("  lifetime in ops (%lu freed, %lu never freed):\n", freed,
+           info->never_freed);
+    for (k = 0; k <= (int)last && freed; k++)
+        printf("  %12lu+ %10lu %6.1f%%\n", 1UL << k, info->life[k],
+               100.0 * info->life[k] / freed);
+
+    if (info->reallocs) {
+        printf("  realloc growth ratio:\n");
+        for (k = 0; k < NUM_RATIOS; k++)
+            printf("  %13s %10lu %6.1f%%\n", ratio_names[k], info->ratios[k],
+                   100.0 * info->ratios[k] / info->reallocs);
+    }
+    printf("\n");
+}
+
+/*
+ * is_trace - scandir filter for .rep files
+ */
+static int is_trace(const struct dirent *d)
+{
+    size_t n = strlen(d->d_name);
+
+    return n > 4 && !strcmp(d->d_name + n - 4, ".rep");
+}
+
+int main(int argc, char **argv)
+{
+    struct dirent **names;
+    char path[MAXLINE];
+    static info_t info, sum;
+    int summary_only = 0, n, i, c;
+
+    while ((c = getopt(argc, argv, "hs")) != EOF) {
+        switch (c) {
+        case 's':
+            summary_only = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: traceinfo [-h] [-s] [<trace> ...]\n");
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+
+    if (optind < argc) {
+        for (i = optind; i < argc; i++) {
+            analyze(argv[i], &info);
+            if (!summary_only)
+                print_info(argv[i], &info);
+            merge(&sum, &info);
+        }
+        n = argc - optind;
+    } else {
+        if ((n = scandir(TRACEDIR, &names, is_trace, alphasort)) < 0)
+            app_error("cannot read %s", TRACEDIR);
+        for (i = 0; i < n; i++) {
+            snprintf(path, sizeof(path), "%s%s", TRACEDIR, names[i]->d_name);
+            analyze(path, &info);
+            if (!summary_only)
+                print_info(path, &info);
+            merge(&sum, &info);
+            free(names[i]);
+        }
+        free(names);
+    }
+
+    if (n > 1 || summary_only)
+        print_info("all traces", &sum);
+    return 0;
+}
+
+/*
+ * app_error - Report an error and exit
+ */
+static void app_error(const char *fmt, const char *arg)
+{
+    fprintf(stderr, "traceinfo: ");
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    exit(1);
+}
@@ -0,0 +1,257 @@
+/*
+ * tracerep.c - turn the records of libtracecap.so into a .rep trace
+ *
+ * usage: tracerep [-a] <records> [<out.rep>]
+ *
+ * The records are sorted by sequence number and replayed: every block
+ * address gets a block id while it is live, and ids of freed blocks are
+ * reused, so num_ids is the peak number of live blocks. Calls on blocks
+ * allocated before recording began are dropped, and so are failed
+ * calls, and requests of 4 GB or more, which the driver cannot replay.
+ * A realloc that moved its block was recorded in two halves: at the
+ * TC_MOVE the old block leaves the table, so that another thread may get
+ * its address, and waits under a key made from the seq of the
+ * TC_REALLOC that ends the move. An address handed out again while the
+ * trace still holds it live is freed first. malloc(0) becomes a 1-byte
+ * request, since the driver takes NULL from malloc for a failure. With
+ * -a, blocks still live at the end are freed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tracecap.h"
+
+#define MAXLINE 1024 /* max string size */
+
+/* Key of a block in the middle of a move, given the seq of the realloc
+   that ends it; odd, so never a block address */
+#define MOVE_KEY(seq) (((seq) << 4) | 1)
+
+/* an entry of the address to block id table (open addressing) */
+typedef struct {
+    uint64_t ptr; /* 0 if empty */
+    int id;
+} slot_t;
+
+/* Global variables */
+static slot_t *table;            /* live blocks by address */
+static size_t table_mask;        /* table length - 1, a power of 2 */
+static int *free_ids;            /* ids ready for reuse (a stack) */
+static int num_free_ids = 0;
+static int num_ids = 0;
+static unsigned long num_ops = 0;
+static FILE *body;               /* ops, written ahead of the header */
+
+static void app_error(const char *msg);
+
+/*
+ * hash - slot where the search for address p starts
+ */
+static size_t hash(uint64_t p)
+{
+    return (size_t)((p >> 4) * 0x9E3779B97F4A7C15ULL) & table_mask;
+}
+
+/*
+ * lookup - id of live block p, -1 if p is not live
+ */
+static int lookup(uint64_t p)
+{
+    size_t i;
+
+    for (i = hash(p); table[i].ptr; i = (i + 1) & table_mask)
+        if (table[i].ptr == p)
+            return table[i].id;
+    return -1;
+}
+
+/*
+ * insert - make p a live block with id id
+ */
+static void insert(uint64_t p, int id)
+{
+    size_t i;
+
+    for (i = hash(p); table[i].ptr; i = (i + 1) & table_mask)
+        ;
+    table[i].ptr = p;
+    table[i].id = id;
+}
+
+/*
+ * erase - p is no longer live; re-place the entries after it so that no
+ *     search stops short at the hole
+ */
+static void erase(uint64_t p)
+{
+    size_t i, j;
+    slot_t s;
+
+    for (i = hash(p); table[i].ptr != p; i = (i + 1) & table_mask)
+        ;
+    table[i].ptr = 0;
+    for (j = (i + 1) & table_mask; table[j].ptr; j = (j + 1) & table_mask) {
+        s = table[j];
+        table[j].ptr = 0;
+        insert(s.ptr, s.id);
+    }
+}
+
+/*
+ * do_alloc, do_free, do_realloc - emit one op and track the live blocks
+ */
+static void do_free(uint64_t p)
+{
+    int id = lookup(p);
+
+    if (id < 0)
+        return;
+    fprintf(body, "f %d\n", id);
+    erase(p);
+    free_ids[num_free_ids++] = id;
+    num_ops++;
+}
+
+static void do_alloc(uint64_t p, uint32_t size)
+{
+    int id;
+
+    do_free(p);
+    id = num_free_ids ? free_ids[--num_free_ids] : num_ids++;
+    fprintf(body, "a %d %u\n", id, size ? size : 1);
+    insert(p, id);
+    num_ops++;
+}
+
+static void do_realloc(uint64_t old, uint64_t p, uint32_t size)
+{
+    int id = lookup(old);
+
+    if (id < 0) {
+        do_alloc(p, size);
+        return;
+    }
+    erase(old);
+    do_free(p);
+    fprintf(body, "r %d %u\n", id, size);
+    insert(p, id);
+    num_ops++;
+}
+
+/*
+ * rec_cmp - qsort comparator ordering records by sequence number
+ */
+static int rec_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const tc_record_t *)a)->seq;
+    uint64_t y = ((const tc_record_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+    tc_record_t *recs, *r;
+    size_t num_recs, i, n;
+    uint64_t old;
+    int id;
+    char buf[MAXLINE];
+    FILE *in, *out = stdout;
+    int free_all = 0, c;
+
+    while ((c = getopt(argc, argv, "ah")) != EOF) {
+        switch (c) {
+        case 'a':
+            free_all = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: tracerep [-a] <records> [<out.rep>]\n");
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (optind >= argc)
+        app_error("no record file given");
+
+    /* Read and sort all records */
+    if ((in = fopen(argv[optind], "rb")) == NULL)
+        app_error("cannot open the record file");
+    fseek(in, 0, SEEK_END);
+    num_recs = ftell(in) / sizeof(tc_record_t);
+    rewind(in);
+    if ((recs = malloc(num_recs * sizeof(tc_record_t) + 1)) == NULL)
+        app_error("out of memory");
+    if (fread(recs, sizeof(tc_record_t), num_recs, in) != num_recs)
+        app_error("short read of the record file");
+    fclose(in);
+    qsort(recs, num_recs, sizeof(tc_record_t), rec_cmp);
+
+    /* Never more live blocks than records: size the table for that */
+    for (table_mask = 1023; table_mask < 2 * num_recs; table_mask = 2 * table_mask + 1)
+        ;
+    table = calloc(table_mask + 1, sizeof(slot_t));
+    free_ids = malloc((num_recs + 1) * sizeof(int));
+    if (table == NULL || free_ids == NULL)
+        app_error("out of memory");
+    if ((body = tmpfile()) == NULL)
+        app_error("cannot create a temporary file");
+
+    for (i = 0; i < num_recs; i++) {
+        r = &recs[i];
+        if (r->size == TC_SIZE_MAX)
+            continue;
+        switch (r->type) {
+        case TC_MALLOC:
+        case TC_CALLOC:
+            if (r->ptr)
+                do_alloc(r->ptr, r->size);
+            break;
+        case TC_FREE:
+            do_free(r->ptr);
+            break;
+        case TC_MOVE:
+            if ((id = lookup(r->old)) >= 0) {
+                erase(r->old);
+                insert(MOVE_KEY(r->ptr), id);
+            }
+            break;
+        case TC_REALLOC:
+            old = (lookup(MOVE_KEY(r->seq)) >= 0) ? MOVE_KEY(r->seq) : r->old;
+            if (r->old == 0 && r->ptr)
+                do_alloc(r->ptr, r->size);
+            else if (r->size == 0)
+                do_free(old);
+            else if (r->ptr)
+                do_realloc(old, r->ptr, r->size);
+            break;
+        default:
+            app_error("bad record type");
+        }
+    }
+    if (free_all)
+        for (i = 0; i <= table_mask; i++)
+            while (table[i].ptr)
+                do_free(table[i].ptr);
+
+    /* Header first, then the ops */
+    if (optind + 1 < argc && (out = fopen(argv[optind + 1], "w")) == NULL)
+        app_error("cannot open the output file");
+    fprintf(out, "0\n%d\n%lu\n0\n", num_ids, num_ops);
+    rewind(body);
+    while ((n = fread(buf, 1, sizeof(buf), body)) > 0)
+        fwrite(buf, 1, n, out);
+    fclose(body);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
+
+/*
+ * app_error - Report an error and exit
+ */
+static void app_error(const char *msg)
+{
+    fprintf(stderr, "tracerep: %s\n", msg);
+    exit(1);
+}